@@ -0,0 +1,143 @@
+#include "asset.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static struct {
+	const uint8_t *base;
+	size_t size;
+	const struct AssetHeader *header;
+	const struct AssetEntry *dir;
+} pack;
+
+bool asset_open(const char *path) {
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if(fd < 0) {
+		fprintf(stderr, "Failed to open asset pack %s (%m)\n", path);
+		return false;
+	}
+	struct stat st;
+	if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(struct AssetHeader)) {
+		fprintf(stderr, "%s is not an asset pack\n", path);
+		close(fd);
+		return false;
+	}
+	void *base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(base == MAP_FAILED) {
+		perror("Failed to map asset pack");
+		return false;
+	}
+
+	const struct AssetHeader *header = base;
+	const struct AssetEntry *dir = (const struct AssetEntry *)(header + 1);
+	bool ok = header->magic == ASSET_MAGIC && header->version == ASSET_VERSION
+		&& sizeof(*header) + header->count * sizeof(*dir) <= (size_t)st.st_size;
+	for(uint16_t i = 0; ok && i < header->count; i++) {
+		ok = dir[i].offset % ASSET_ALIGN == 0
+			&& dir[i].offset <= st.st_size && dir[i].size <= st.st_size - dir[i].offset
+			&& memchr(dir[i].name, '\0', ASSET_NAME_MAX) != NULL;
+	}
+	if(!ok) {
+		fprintf(stderr, "%s is not a version %d asset pack\n", path, ASSET_VERSION);
+		munmap(base, st.st_size);
+		return false;
+	}
+
+	pack.base = base;
+	pack.size = st.st_size;
+	pack.header = header;
+	pack.dir = dir;
+
+	// The directory is read right away anyway, the rest is mostly read
+	// where the camera happens to be
+	for(uint16_t i = 0; i < header->count; i++) {
+		if(dir[i].flags & ASSET_WILLNEED) {
+			madvise((void *)(pack.base + dir[i].offset), dir[i].size, MADV_WILLNEED);
+		}
+	}
+	return true;
+}
+
+static const struct AssetEntry *find(const char *name, enum AssetType type) {
+	if(pack.base == NULL) {
+		return NULL;
+	}
+	for(uint16_t i = 0; i < pack.header->count; i++) {
+		if(strcmp(pack.dir[i].name, name) == 0) {
+			return pack.dir[i].type == type ? &pack.dir[i] : NULL;
+		}
+	}
+	return NULL;
+}
+
+const struct Tex *asset_tex(const char *name) {
+	const struct AssetEntry *e = find(name, ASSET_TEX);
+	if(e == NULL || e->size < sizeof(struct Tex)) {
+		return NULL;
+	}
+	const struct Tex *tex = (const struct Tex *)(pack.base + e->offset);
+	if(tex->width == 0 || tex->height == 0 || (uint64_t)tex->width * tex->height > e->size - sizeof(struct Tex)) {
+		return NULL;
+	}
+	return tex;
+}
+
+const void *asset_raw(const char *name, size_t *size) {
+	const struct AssetEntry *e = find(name, ASSET_RAW);
+	if(e == NULL) {
+		return NULL;
+	}
+	*size = e->size;
+	return pack.base + e->offset;
+}
+
+static const struct AssetEntry *entry_at(const void *asset) {
+	const uint8_t *p = asset;
+	if(pack.base == NULL || p < pack.base || p >= pack.base + pack.size) {
+		return NULL;
+	}
+	for(uint16_t i = 0; i < pack.header->count; i++) {
+		if(p == pack.base + pack.dir[i].offset) {
+			return &pack.dir[i];
+		}
+	}
+	return NULL;
+}
+
+bool asset_lazy(const void *asset) {
+	const struct AssetEntry *e = entry_at(asset);
+	return e != NULL && !(e->flags & ASSET_WILLNEED);
+}
+
+void asset_report(void) {
+	if(pack.base == NULL) {
+		return;
+	}
+	long page = sysconf(_SC_PAGESIZE);
+	printf("Asset pack: %zu KB mapped\n", pack.size / 1024);
+	for(uint16_t i = 0; i < pack.header->count; i++) {
+		const struct AssetEntry *e = &pack.dir[i];
+		size_t pages = (e->size + page - 1) / page;
+		size_t resident = 0;
+		unsigned char vec[pages > 0 ? pages : 1];
+		if(pages > 0 && mincore((void *)(pack.base + e->offset), e->size, vec) == 0) {
+			for(size_t p = 0; p < pages; p++) {
+				resident += vec[p] & 1;
+			}
+		}
+		printf("  %-16s %7u bytes, %3zu of %3zu pages resident\n", e->name, e->size, resident, pages);
+	}
+}
+
+void asset_close(void) {
+	if(pack.base != NULL) {
+		munmap((void *)pack.base, pack.size);
+	}
+	memset(&pack, 0, sizeof(pack));
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "game.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Asset packs. One file with a directory up front and every asset starting
+// on its own page, so it can be mapped read-only and used in place: a
+// texture in the pack is a struct Tex as is. Only the pages something reads
+// get loaded, unless the pack asks for an asset to be read ahead.
+//
+// Everything is little endian. mkpack writes them.
+#define ASSET_MAGIC 0x4b415046 // "FPAK"
+#define ASSET_VERSION 1
+#define ASSET_ALIGN 4096
+#define ASSET_NAME_MAX 16
+
+enum AssetType {
+	ASSET_TEX = 1,
+	ASSET_RAW = 2,
+};
+
+// Read the asset ahead when the pack is opened, for ones that will all be
+// needed right away
+#define ASSET_WILLNEED 0x01
+
+struct AssetHeader {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t count;
+	// The directory follows the header
+};
+
+struct AssetEntry {
+	char name[ASSET_NAME_MAX];
+	uint16_t type;
+	uint16_t flags;
+	uint32_t offset;
+	uint32_t size;
+	uint32_t reserved;
+};
+
+// Map a pack. Returns false, after saying why, if it's missing or broken.
+bool asset_open(const char *path);
+// NULL if the pack has no such asset, or it isn't the right type
+const struct Tex *asset_tex(const char *name);
+const void *asset_raw(const char *name, size_t *size);
+// Whether this is an asset from the pack that should only be loaded as it's
+// read, as opposed to one it reads ahead or one that isn't from the pack
+bool asset_lazy(const void *asset);
+// How much of each asset ended up in memory
+void asset_report(void);
+void asset_close(void);
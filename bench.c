@@ -0,0 +1,98 @@
+#include "bench.h"
+#include "prof.h"
+
+#include <linux/perf_event.h>
+#include <math.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+enum {
+	COUNTER_CYCLES,
+	COUNTER_INSTRUCTIONS,
+	COUNTER_CACHE_MISSES,
+	COUNTER_LAST,
+};
+
+// One group, so all of them count over exactly the same stretch. -1 until
+// opened, -2 if we can't have them.
+static int counter_group = -1;
+
+static int open_counter(uint64_t config, int group) {
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = config;
+	attr.disabled = group == -1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_GROUP;
+	return syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+}
+
+static bool counters_open(void) {
+	if(counter_group == -1) {
+		static const uint64_t configs[COUNTER_LAST] = {
+			[COUNTER_CYCLES] = PERF_COUNT_HW_CPU_CYCLES,
+			[COUNTER_INSTRUCTIONS] = PERF_COUNT_HW_INSTRUCTIONS,
+			[COUNTER_CACHE_MISSES] = PERF_COUNT_HW_CACHE_MISSES,
+		};
+		int group = open_counter(configs[0], -1);
+		for(int i = 1; i < COUNTER_LAST && group >= 0; i++) {
+			if(open_counter(configs[i], group) < 0) {
+				close(group);
+				group = -1;
+			}
+		}
+		counter_group = group >= 0 ? group : -2;
+	}
+	return counter_group >= 0;
+}
+
+struct BenchResult bench_run(void (*fn)(void *arg), void *arg, uint32_t warmup, uint32_t reps) {
+	for(uint32_t i = 0; i < warmup; i++) {
+		fn(arg);
+	}
+
+	struct BenchResult result = {
+		.reps = reps,
+		.min_ns = 1e18,
+		.counters = counters_open(),
+	};
+	if(result.counters) {
+		ioctl(counter_group, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+		ioctl(counter_group, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+	}
+
+	// Welford, so a long run doesn't lose the variance to rounding
+	double mean = 0.0, m2 = 0.0;
+	for(uint32_t i = 0; i < reps; i++) {
+		uint64_t start = prof_now();
+		fn(arg);
+		uint64_t ns = prof_now() - start;
+		if(ns < result.min_ns) result.min_ns = ns;
+		double delta = ns - mean;
+		mean += delta / (i + 1);
+		m2 += delta * (ns - mean);
+	}
+	result.mean_ns = mean;
+	result.stddev_ns = reps > 1 ? sqrt(m2 / (reps - 1)) : 0.0;
+
+	if(result.counters) {
+		ioctl(counter_group, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+		struct {
+			uint64_t nr;
+			uint64_t values[COUNTER_LAST];
+		} counts;
+		if(read(counter_group, &counts, sizeof(counts)) == sizeof(counts) && counts.nr == COUNTER_LAST) {
+			result.cycles = counts.values[COUNTER_CYCLES] / (double)reps;
+			result.instructions = counts.values[COUNTER_INSTRUCTIONS] / (double)reps;
+			result.cache_misses = counts.values[COUNTER_CACHE_MISSES] / (double)reps;
+		} else {
+			result.counters = false;
+		}
+	}
+	return result;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct BenchResult {
+	uint32_t reps;
+	// Per call
+	double mean_ns;
+	double min_ns;
+	double stddev_ns;
+	// Hardware counters per call, only set when counters is. That needs
+	// perf_event_open, which kernel.perf_event_paranoid or a container can
+	// take away from us.
+	bool counters;
+	double cycles;
+	double instructions;
+	double cache_misses;
+};
+
+// Call fn(arg) warmup times untimed, then time reps calls of it
+struct BenchResult bench_run(void (*fn)(void *arg), void *arg, uint32_t warmup, uint32_t reps);
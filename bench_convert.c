@@ -0,0 +1,55 @@
+#include "bench.h"
+#include "convert.h"
+#include "render.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+struct Job {
+	const struct Converter *c;
+	const uint8_t *canvas;
+	uint8_t *out;
+};
+
+static void convert_frame(void *arg) {
+	struct Job *job = arg;
+	size_t stride = convert_row_bytes(job->c, WIDTH);
+	for(uint16_t y = 0; y < HEIGHT; y++) {
+		job->c->row(job->out + y * stride, job->canvas + y * WIDTH * 4, WIDTH);
+	}
+}
+
+int main(int argc, char *argv[]) {
+	static uint8_t canvas[WIDTH * HEIGHT * 4];
+	static uint8_t out[WIDTH * HEIGHT * 4];
+
+	// Dithered frames are close to noise, so that's what we feed it
+	srand(1);
+	for(uint32_t i = 0; i < WIDTH * HEIGHT; i++) {
+		uint8_t v = rand() & 1 ? 255 : 0;
+		canvas[i*4 + 0] = v;
+		canvas[i*4 + 1] = v;
+		canvas[i*4 + 2] = v;
+		canvas[i*4 + 3] = 255;
+	}
+
+	printf("%-14s %10s %10s %12s %12s\n", "converter", "bytes", "us/frame", "Mpixel/s", "MB/s out");
+	for(size_t i = 0; i < nconverters; i++) {
+		struct Job job = {
+			.c = &converters[i],
+			.canvas = canvas,
+			.out = out,
+		};
+		struct BenchResult r = bench_run(convert_frame, &job, 100, 2000);
+		size_t bytes = convert_row_bytes(job.c, WIDTH) * HEIGHT;
+		printf(
+			"%-14s %10zu %10.2f %12.1f %12.1f\n",
+			job.c->name,
+			bytes,
+			r.mean_ns / 1e3,
+			WIDTH * HEIGHT / r.mean_ns * 1e3,
+			bytes / r.mean_ns * 1e3
+		);
+	}
+	return 0;
+}
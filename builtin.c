@@ -0,0 +1,29 @@
+#include "game.h"
+#include "font8x8_basic.h"
+
+// The assets built into the binary. Builds with ASSETS=PACK leave this out
+// and load them from an asset pack instead, and mkpack uses it to write the
+// default pack.
+
+const struct Tex noiseTexture = {
+	.width = 512,
+	.height = 512,
+	.data = {
+#include "noise.h"
+	},
+};
+
+const struct Tex ditherTexture = {
+	.width = 8,
+	.height = 8,
+	.data = {
+		0x03, 0x83, 0x23, 0xa3, 0x0b, 0x8b, 0x2b, 0xab,
+		0xc3, 0x43, 0xe3, 0x63, 0xcb, 0x4b, 0xeb, 0x6b,
+		0x33, 0xb3, 0x13, 0x93, 0x3b, 0xbb, 0x1b, 0x9b,
+		0xf3, 0x73, 0xd3, 0x53, 0xfb, 0x7b, 0xdb, 0x5b,
+		0x0f, 0x8f, 0x2f, 0xaf, 0x07, 0x87, 0x27, 0xa7,
+		0xcf, 0x4f, 0xef, 0x6f, 0xc7, 0x47, 0xe7, 0x67,
+		0x3f, 0xbf, 0x1f, 0x9f, 0x37, 0xb7, 0x17, 0x97,
+		0xff, 0x7f, 0xdf, 0x5f, 0xf7, 0x77, 0xd7, 0x57
+	}
+};
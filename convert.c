@@ -0,0 +1,180 @@
+#include "convert.h"
+
+#include <assert.h>
+#include <string.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define CONVERT_NEON 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define CONVERT_SSE2 1
+#endif
+
+// The color channels are either all set or all clear, so the first one is
+// as good as any
+static inline uint8_t lum(const uint8_t *src, uint16_t x) {
+	return src[x * 4];
+}
+
+static void xrgb8888_scalar(uint8_t *restrict dst, const uint8_t *restrict src, uint16_t width) {
+	// The canvas is already laid out like this
+	memcpy(dst, src, width * 4);
+}
+
+static void rgb565_scalar(uint8_t *restrict dst, const uint8_t *restrict src, uint16_t width) {
+	for(uint16_t x = 0; x < width; x++) {
+		uint8_t v = lum(src, x);
+		dst[x*2 + 0] = v;
+		dst[x*2 + 1] = v;
+	}
+}
+
+static void gray8_scalar(uint8_t *restrict dst, const uint8_t *restrict src, uint16_t width) {
+	for(uint16_t x = 0; x < width; x++) {
+		dst[x] = lum(src, x);
+	}
+}
+
+static inline void mono_scalar(uint8_t *restrict dst, const uint8_t *restrict src, uint16_t width, uint8_t invert) {
+	assert(width % 8 == 0);
+	for(uint16_t x = 0; x < width; x += 8) {
+		uint8_t bits = 0;
+		for(uint8_t b = 0; b < 8; b++) {
+			bits |= (lum(src, x + b) != 0) << (7 - b);
+		}
+		dst[x/8] = bits ^ invert;
+	}
+}
+
+static void mono10_scalar(uint8_t *restrict dst, const uint8_t *restrict src, uint16_t width) {
+	mono_scalar(dst, src, width, 0x00);
+}
+
+static void mono01_scalar(uint8_t *restrict dst, const uint8_t *restrict src, uint16_t width) {
+	mono_scalar(dst, src, width, 0xFF);
+}
+
+#if CONVERT_NEON
+// Each vld4q deinterleaves 16 pixels, so the first channel is one byte per
+// pixel
+static void rgb565_neon(uint8_t *restrict dst, const uint8_t *restrict src, uint16_t width) {
+	uint16_t x = 0;
+	for(; x + 16 <= width; x += 16) {
+		uint8x16_t v = vld4q_u8(src + x*4).val[0];
+		uint8x16x2_t out = { { v, v } };
+		vst2q_u8(dst + x*2, out);
+	}
+	rgb565_scalar(dst + x*2, src + x*4, width - x);
+}
+
+static void gray8_neon(uint8_t *restrict dst, const uint8_t *restrict src, uint16_t width) {
+	uint16_t x = 0;
+	for(; x + 16 <= width; x += 16) {
+		vst1q_u8(dst + x, vld4q_u8(src + x*4).val[0]);
+	}
+	gray8_scalar(dst + x, src + x*4, width - x);
+}
+
+static inline void mono_neon(uint8_t *restrict dst, const uint8_t *restrict src, uint16_t width, uint8_t invert) {
+	static const uint8_t weights[16] = {
+		0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01,
+		0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01,
+	};
+	const uint8x16_t w = vld1q_u8(weights);
+	const uint8x8_t inv = vdup_n_u8(invert);
+
+	uint16_t x = 0;
+	for(; x + 16 <= width; x += 16) {
+		uint8x16_t bits = vandq_u8(vld4q_u8(src + x*4).val[0], w);
+		// Three pairwise adds fold each group of 8 lanes into one byte
+		uint8x8_t p = vpadd_u8(vget_low_u8(bits), vget_high_u8(bits));
+		p = vpadd_u8(p, p);
+		p = vpadd_u8(p, p);
+		p = veor_u8(p, inv);
+		vst1_lane_u16((uint16_t *)(dst + x/8), vreinterpret_u16_u8(p), 0);
+	}
+	mono_scalar(dst + x/8, src + x*4, width - x, invert);
+}
+
+static void mono10_neon(uint8_t *restrict dst, const uint8_t *restrict src, uint16_t width) {
+	mono_neon(dst, src, width, 0x00);
+}
+
+static void mono01_neon(uint8_t *restrict dst, const uint8_t *restrict src, uint16_t width) {
+	mono_neon(dst, src, width, 0xFF);
+}
+#endif
+
+#if CONVERT_SSE2
+// 0xFF for every black pixel in the 16 pixels at src
+static inline __m128i black16_sse2(const uint8_t *src) {
+	const __m128i rgb = _mm_set1_epi32(0x00FFFFFF);
+	const __m128i zero = _mm_setzero_si128();
+	__m128i p[4];
+	for(uint8_t i = 0; i < 4; i++) {
+		p[i] = _mm_cmpeq_epi32(_mm_and_si128(_mm_loadu_si128((const __m128i *)(src + i*16)), rgb), zero);
+	}
+	return _mm_packs_epi16(_mm_packs_epi32(p[0], p[1]), _mm_packs_epi32(p[2], p[3]));
+}
+
+// movemask puts the leftmost pixel in the lowest bit, the panel wants it in
+// the highest
+static const uint8_t reverse[256] = {
+#define R2(n) n, n + 2*64, n + 1*64, n + 3*64
+#define R4(n) R2(n), R2(n + 2*16), R2(n + 1*16), R2(n + 3*16)
+#define R6(n) R4(n), R4(n + 2*4), R4(n + 1*4), R4(n + 3*4)
+	R6(0), R6(2), R6(1), R6(3)
+#undef R6
+#undef R4
+#undef R2
+};
+
+static inline void mono_sse2(uint8_t *restrict dst, const uint8_t *restrict src, uint16_t width, uint8_t invert) {
+	uint16_t x = 0;
+	for(; x + 16 <= width; x += 16) {
+		// Set bits are black, so flip for the white-is-one layout
+		uint16_t bits = _mm_movemask_epi8(black16_sse2(src + x*4)) ^ (invert ? 0x0000 : 0xFFFF);
+		dst[x/8 + 0] = reverse[bits & 0xFF];
+		dst[x/8 + 1] = reverse[bits >> 8];
+	}
+	mono_scalar(dst + x/8, src + x*4, width - x, invert);
+}
+
+static void mono10_sse2(uint8_t *restrict dst, const uint8_t *restrict src, uint16_t width) {
+	mono_sse2(dst, src, width, 0x00);
+}
+
+static void mono01_sse2(uint8_t *restrict dst, const uint8_t *restrict src, uint16_t width) {
+	mono_sse2(dst, src, width, 0xFF);
+}
+#endif
+
+const struct Converter converters[] = {
+	{ "xrgb8888", PF_XRGB8888, 32, xrgb8888_scalar },
+#if CONVERT_NEON
+	{ "rgb565-neon", PF_RGB565, 16, rgb565_neon },
+	{ "gray8-neon", PF_GRAY8, 8, gray8_neon },
+	{ "mono10-neon", PF_MONO10, 1, mono10_neon },
+	{ "mono01-neon", PF_MONO01, 1, mono01_neon },
+#elif CONVERT_SSE2
+	// The compiler already vectorizes the scalar rgb565 and gray8 loops
+	// at least as well on x86, only bit packing needs the help
+	{ "mono10-sse2", PF_MONO10, 1, mono10_sse2 },
+	{ "mono01-sse2", PF_MONO01, 1, mono01_sse2 },
+#endif
+	{ "rgb565", PF_RGB565, 16, rgb565_scalar },
+	{ "gray8", PF_GRAY8, 8, gray8_scalar },
+	{ "mono10", PF_MONO10, 1, mono10_scalar },
+	{ "mono01", PF_MONO01, 1, mono01_scalar },
+};
+const size_t nconverters = sizeof(converters) / sizeof(converters[0]);
+
+const struct Converter *convert_find(enum PixelFormat format) {
+	for(size_t i = 0; i < nconverters; i++) {
+		if(converters[i].format == format) {
+			return &converters[i];
+		}
+	}
+	return NULL;
+}
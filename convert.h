@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Converters from the canvas (4 bytes per pixel, every pixel either all 0 or
+// all 255 in the color channels) to what a panel wants
+enum PixelFormat {
+	PF_XRGB8888,
+	PF_RGB565,
+	PF_GRAY8,
+	// 1bpp, leftmost pixel in the most significant bit. MONO10 has 1 as
+	// white, MONO01 has 1 as black.
+	PF_MONO10,
+	PF_MONO01,
+};
+
+typedef void (*convert_row)(uint8_t *restrict dst, const uint8_t *restrict src, uint16_t width);
+
+struct Converter {
+	const char *name;
+	enum PixelFormat format;
+	uint8_t bpp;
+	convert_row row;
+};
+
+// Every converter we have. For each format the SIMD variant, if any, comes
+// before the scalar one.
+extern const struct Converter converters[];
+extern const size_t nconverters;
+
+// The fastest converter for the format
+const struct Converter *convert_find(enum PixelFormat format);
+
+static inline size_t convert_row_bytes(const struct Converter *c, uint16_t width) {
+	return ((size_t)width * c->bpp + 7) / 8;
+}
@@ -0,0 +1,423 @@
+#include "draw.h"
+#include "sprite.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef ASSETS_PACK
+const char (*font)[8] = NULL;
+#else
+extern char font8x8_basic[128][8];
+const char (*font)[8] = font8x8_basic;
+#endif
+
+// With a clip rectangle pixels outside it are skipped, but the whole line
+// is still walked so the fill pattern lines up across tiles
+struct LineTarget {
+	struct RenderContext *ctx;
+	const struct Rect *clip;
+	uint8_t v;
+};
+
+static inline void plotClipped(void *arg, uint16_t x, uint16_t y) {
+	const struct LineTarget *l = arg;
+	const struct Rect *clip = l->clip;
+	if(clip == NULL || (x >= clip->x0 && x < clip->x1 && y >= clip->y0 && y < clip->y1)) {
+		plot(l->ctx, x, y, l->v);
+	}
+}
+
+static inline void line(struct RenderContext *ctx, uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1, uint8_t fill, uint8_t v, const struct Rect *clip) {
+	struct LineTarget l = {
+		.ctx = ctx,
+		.clip = clip,
+		.v = v,
+	};
+	line_walk(x0, y0, x1, y1, fill, plotClipped, &l);
+}
+
+void plotLine(struct RenderContext *ctx, uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1, uint8_t fill, uint8_t v) {
+	line(ctx, x0, y0, x1, y1, fill, v, NULL);
+}
+
+void text(char *str, uint8_t *pos, uint32_t stride) {
+	for(char *c = str; *c != '\0'; c++) {
+		const uint8_t *letter = (const uint8_t *)font[(uint8_t)*c];
+		for(uint8_t row = 0; row < 8; row++) {
+			uint8_t mask = 0x01;
+			for(uint8_t col = 0; col < 8; col++) {
+				if((letter[row] & mask) != 0) {
+					pos[0] = 255;
+					pos[1] = 255;
+					pos[2] = 255;
+					pos[3] = 255;
+				}
+				pos += 4;
+				mask = mask << 1;
+			}
+			pos += stride - 4*8;
+		}
+		pos -= stride * 8 - 8*4;
+	}
+}
+
+static void textClipped(struct RenderContext *ctx, uint16_t x, uint16_t y, const char *str, const struct Rect *clip) {
+	for(const char *c = str; *c != '\0'; c++, x += 8) {
+		const uint8_t *letter = (const uint8_t *)font[(uint8_t)*c];
+		for(uint8_t row = 0; row < 8; row++) {
+			if(y + row < clip->y0 || y + row >= clip->y1) {
+				continue;
+			}
+			for(uint8_t col = 0; col < 8; col++) {
+				if((letter[row] & (1 << col)) != 0 && x + col >= clip->x0 && x + col < clip->x1) {
+					plot(ctx, x + col, y + row, 1);
+				}
+			}
+		}
+	}
+}
+
+void draw_reset(struct DrawList *list) {
+	list->count = 0;
+	list->text_len = 0;
+}
+
+static struct DrawCmd *add(struct DrawList *list) {
+	// Dropping an overlay is better than dropping the frame
+	assert(list->count < DRAW_MAX);
+	if(list->count >= DRAW_MAX) {
+		return NULL;
+	}
+	return &list->cmds[list->count++];
+}
+
+void draw_line(struct DrawList *list, uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1, uint8_t fill, uint8_t v) {
+	struct DrawCmd *cmd = add(list);
+	if(cmd == NULL) {
+		return;
+	}
+	*cmd = (struct DrawCmd){
+		.op = DRAW_LINE,
+		.fill = fill,
+		.v = v,
+		.x0 = x0,
+		.y0 = y0,
+		.x1 = x1,
+		.y1 = y1,
+	};
+	cmd->bounds = (struct Rect){
+		.x0 = x0 < x1 ? x0 : x1,
+		.y0 = y0 < y1 ? y0 : y1,
+		.x1 = (x0 < x1 ? x1 : x0) + 1,
+		.y1 = (y0 < y1 ? y1 : y0) + 1,
+	};
+}
+
+void draw_text(struct DrawList *list, uint16_t x, uint16_t y, const char *str) {
+	size_t len = strnlen(str, DRAW_TEXT_MAX);
+	assert(list->text_len + len < DRAW_TEXT_BYTES);
+	if(list->text_len + len >= DRAW_TEXT_BYTES) {
+		return;
+	}
+	struct DrawCmd *cmd = add(list);
+	if(cmd == NULL) {
+		return;
+	}
+	cmd->op = DRAW_TEXT;
+	cmd->x0 = x;
+	cmd->y0 = y;
+	cmd->text = list->text_len;
+	memcpy(list->text + list->text_len, str, len);
+	list->text[list->text_len + len] = '\0';
+	list->text_len += len + 1;
+	cmd->bounds = (struct Rect){
+		.x0 = x,
+		.y0 = y,
+		.x1 = x + len * 8,
+		.y1 = y + 8,
+	};
+}
+
+void draw_sprite(struct DrawList *list, const struct Sprite *sprite, uint16_t x, uint16_t y, uint8_t v) {
+	struct DrawCmd *cmd = add(list);
+	if(cmd == NULL) {
+		return;
+	}
+	cmd->op = DRAW_SPRITE;
+	cmd->v = v;
+	cmd->x0 = x;
+	cmd->y0 = y;
+	cmd->sprite = sprite;
+	int32_t left = x + sprite->x, top = y + sprite->y;
+	cmd->bounds = (struct Rect){
+		.x0 = left < 0 ? 0 : left,
+		.y0 = top < 0 ? 0 : top,
+		.x1 = left + sprite->width > 0 ? left + sprite->width : 0,
+		.y1 = top + sprite->height > 0 ? top + sprite->height : 0,
+	};
+}
+
+// Tiles across and down the canvas
+static inline uint16_t tiles_x(const struct RenderContext *ctx) {
+	return (ctx->width + TILE_W - 1) / TILE_W;
+}
+
+static inline uint16_t tiles_y(const struct RenderContext *ctx) {
+	return (ctx->height + TILE_H - 1) / TILE_H;
+}
+
+// The tiles of a canvas columns by rows tiles big that bounds overlaps
+static inline struct Rect tiles_under(const struct Rect *bounds, uint16_t columns, uint16_t rows) {
+	struct Rect t = {
+		.x0 = bounds->x0 / TILE_W,
+		.y0 = bounds->y0 / TILE_H,
+		.x1 = (bounds->x1 + TILE_W - 1) / TILE_W,
+		.y1 = (bounds->y1 + TILE_H - 1) / TILE_H,
+	};
+	if(t.x1 > columns) t.x1 = columns;
+	if(t.y1 > rows) t.y1 = rows;
+	if(t.x0 > t.x1) t.x0 = t.x1;
+	if(t.y0 > t.y1) t.y0 = t.y1;
+	return t;
+}
+
+// A counting sort of the commands by tile, like entity_build(), with a
+// command that overlaps several tiles in each of them. Scattering moves
+// every tile's start up to the next one's, so they're moved back after.
+static void bin(struct DrawList *list, const struct RenderContext *ctx) {
+	uint16_t columns = tiles_x(ctx), rows = tiles_y(ctx), tiles = columns * rows;
+	memset(list->start, 0, (tiles + 1) * sizeof(list->start[0]));
+	uint32_t binned = 0;
+	for(uint16_t i = 0; i < list->count; i++) {
+		struct Rect t = tiles_under(&list->cmds[i].bounds, columns, rows);
+		uint32_t n = (t.x1 - t.x0) * (t.y1 - t.y0);
+		// Dropping an overlay is better than dropping the frame
+		assert(binned + n <= DRAW_BINNED);
+		if(binned + n > DRAW_BINNED) {
+			list->cmds[i].bounds = (struct Rect){0};
+			continue;
+		}
+		binned += n;
+		for(uint16_t ty = t.y0; ty < t.y1; ty++) {
+			for(uint16_t tx = t.x0; tx < t.x1; tx++) {
+				list->start[ty * columns + tx + 1]++;
+			}
+		}
+	}
+	for(uint16_t tile = 0; tile < tiles; tile++) {
+		list->start[tile + 1] += list->start[tile];
+	}
+	for(uint16_t i = 0; i < list->count; i++) {
+		struct Rect t = tiles_under(&list->cmds[i].bounds, columns, rows);
+		for(uint16_t ty = t.y0; ty < t.y1; ty++) {
+			for(uint16_t tx = t.x0; tx < t.x1; tx++) {
+				list->binned[list->start[ty * columns + tx]++] = i;
+			}
+		}
+	}
+	memmove(list->start + 1, list->start, tiles * sizeof(list->start[0]));
+	list->start[0] = 0;
+}
+
+// Only rows y0 to y1 of the tile
+static void draw_tile(struct DrawList *list, struct RenderContext *ctx, uint16_t tile, uint16_t y0, uint16_t y1, draw_background background, void *arg) {
+	struct Rect r = {
+		.x0 = tile % tiles_x(ctx) * TILE_W,
+		.y0 = tile / tiles_x(ctx) * TILE_H,
+	};
+	r.x1 = r.x0 + TILE_W < ctx->width ? r.x0 + TILE_W : ctx->width;
+	r.y1 = r.y0 + TILE_H < y1 ? r.y0 + TILE_H : y1;
+	if(r.y0 < y0) r.y0 = y0;
+
+	background(ctx, &r, arg);
+	for(uint16_t i = list->start[tile]; i < list->start[tile + 1]; i++) {
+		const struct DrawCmd *cmd = &list->cmds[list->binned[i]];
+		switch(cmd->op) {
+			case DRAW_LINE:
+				line(ctx, cmd->x0, cmd->y0, cmd->x1, cmd->y1, cmd->fill, cmd->v, &r);
+				break;
+			case DRAW_TEXT:
+				textClipped(ctx, cmd->x0, cmd->y0, list->text + cmd->text, &r);
+				break;
+			case DRAW_SPRITE:
+				sprite_blit(ctx, cmd->sprite, cmd->x0, cmd->y0, cmd->v, &r);
+				break;
+		}
+	}
+}
+
+#define DRAW_MAX_THREADS 16
+
+static struct {
+	uint8_t nthreads;
+	pthread_t threads[DRAW_MAX_THREADS];
+	void (*init)(void);
+
+	pthread_mutex_t lock;
+	pthread_cond_t go;
+	pthread_cond_t done;
+	// Bumped for every frame, and the workers still on it
+	uint32_t generation;
+	uint8_t busy;
+	bool quit;
+
+	// The frame being drawn
+	struct DrawList *list;
+	struct RenderContext *ctx;
+	draw_background background;
+	void *arg;
+	atomic_uint next;
+} pool = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.go = PTHREAD_COND_INITIALIZER,
+	.done = PTHREAD_COND_INITIALIZER,
+};
+
+// Take tiles off the frame until there are none left
+static void take_tiles(void) {
+	unsigned tiles = tiles_x(pool.ctx) * tiles_y(pool.ctx);
+	for(unsigned n; (n = atomic_fetch_add(&pool.next, 1)) < tiles;) {
+		draw_tile(pool.list, pool.ctx, n, 0, pool.ctx->height, pool.background, pool.arg);
+	}
+}
+
+static void *worker(void *arg) {
+	if(pool.init != NULL) {
+		pool.init();
+	}
+
+	uint32_t seen = 0;
+	pthread_mutex_lock(&pool.lock);
+	for(;;) {
+		while(pool.generation == seen && !pool.quit) {
+			pthread_cond_wait(&pool.go, &pool.lock);
+		}
+		if(pool.quit) {
+			break;
+		}
+		seen = pool.generation;
+		pthread_mutex_unlock(&pool.lock);
+
+		take_tiles();
+
+		pthread_mutex_lock(&pool.lock);
+		if(--pool.busy == 0) {
+			pthread_cond_signal(&pool.done);
+		}
+	}
+	pthread_mutex_unlock(&pool.lock);
+	return NULL;
+}
+
+void draw_start(uint8_t threads, void (*init)(void)) {
+	pool.init = init;
+	pool.quit = false;
+	for(pool.nthreads = 0; pool.nthreads < threads && pool.nthreads < DRAW_MAX_THREADS; pool.nthreads++) {
+		if(pthread_create(&pool.threads[pool.nthreads], NULL, worker, NULL) != 0) {
+			break;
+		}
+	}
+}
+
+void draw_stop(void) {
+	pthread_mutex_lock(&pool.lock);
+	pool.quit = true;
+	pthread_cond_broadcast(&pool.go);
+	pthread_mutex_unlock(&pool.lock);
+	for(uint8_t i = 0; i < pool.nthreads; i++) {
+		pthread_join(pool.threads[i], NULL);
+	}
+	pool.nthreads = 0;
+}
+
+// Room for two tiles each way, and for the dolphin around the center
+#define MIN_WIDTH 160
+#define MIN_HEIGHT 96
+
+void draw_size(struct RenderContext *ctx, uint32_t fit_width, uint32_t fit_height, uint32_t want_width, uint32_t want_height) {
+	const char *size = getenv("FLIPPER_SIZE");
+	if(size != NULL && sscanf(size, "%ux%u", &want_width, &want_height) != 2) {
+		fprintf(stderr, "FLIPPER_SIZE should look like 800x480, not %s\n", size);
+		exit(1);
+	}
+	if(fit_width > MAX_WIDTH) fit_width = MAX_WIDTH;
+	if(fit_height > MAX_HEIGHT) fit_height = MAX_HEIGHT;
+	if(want_width > fit_width || want_height > fit_height) {
+		if(size != NULL) {
+			fprintf(stderr, "FLIPPER_SIZE %ux%u doesn't fit, at most %ux%u\n", want_width, want_height, fit_width, fit_height);
+			exit(1);
+		}
+		want_width = want_width > fit_width ? fit_width : want_width;
+		want_height = want_height > fit_height ? fit_height : want_height;
+	}
+	want_width -= want_width % 8;
+	want_height -= want_height % 2;
+	if(want_width < MIN_WIDTH || want_height < MIN_HEIGHT) {
+		fprintf(stderr, "Canvas of %ux%u is too small, we need at least %ux%u\n", want_width, want_height, MIN_WIDTH, MIN_HEIGHT);
+		exit(1);
+	}
+	ctx->width = want_width;
+	ctx->height = want_height;
+}
+
+uint16_t draw_band_rows(const struct RenderContext *ctx) {
+	if(getenv("FLIPPER_BAND") == NULL) {
+		return 0;
+	}
+	int rows = atoi(getenv("FLIPPER_BAND"));
+	rows += rows % 2;
+	return rows < 2 ? 2 : rows > ctx->height ? ctx->height : rows;
+}
+
+// Every band goes through the tiles it crosses, and each of those draws
+// the rows it has in the band
+static void draw_bands(struct DrawList *list, struct RenderContext *ctx, draw_background background, void *arg) {
+	for(uint16_t y0 = 0; y0 < ctx->height; y0 += ctx->band_rows) {
+		uint16_t y1 = y0 + ctx->band_rows < ctx->height ? y0 + ctx->band_rows : ctx->height;
+		ctx->top = y0;
+		for(uint16_t ty = y0 / TILE_H; ty * TILE_H < y1; ty++) {
+			for(uint16_t tx = 0; tx < tiles_x(ctx); tx++) {
+				draw_tile(list, ctx, ty * tiles_x(ctx) + tx, y0, y1, background, arg);
+			}
+		}
+		ctx->band(ctx, y0, y1);
+	}
+}
+
+void draw_tiles(struct DrawList *list, struct RenderContext *ctx, draw_background background, void *arg) {
+	bin(list, ctx);
+	if(ctx->band_rows != 0) {
+		draw_bands(list, ctx, background, arg);
+		return;
+	}
+	if(pool.nthreads == 0) {
+		for(uint16_t n = 0; n < tiles_x(ctx) * tiles_y(ctx); n++) {
+			draw_tile(list, ctx, n, 0, ctx->height, background, arg);
+		}
+		return;
+	}
+
+	pthread_mutex_lock(&pool.lock);
+	pool.list = list;
+	pool.ctx = ctx;
+	pool.background = background;
+	pool.arg = arg;
+	atomic_store(&pool.next, 0);
+	pool.busy = pool.nthreads;
+	pool.generation++;
+	pthread_cond_broadcast(&pool.go);
+	pthread_mutex_unlock(&pool.lock);
+
+	// Pitch in rather than wait
+	take_tiles();
+
+	pthread_mutex_lock(&pool.lock);
+	while(pool.busy > 0) {
+		pthread_cond_wait(&pool.done, &pool.lock);
+	}
+	pthread_mutex_unlock(&pool.lock);
+}
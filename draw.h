@@ -0,0 +1,149 @@
+#pragma once
+
+#include "render.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+static inline void plot(struct RenderContext *ctx, uint16_t x, uint16_t y, uint8_t v) {
+	assert(x >= 0 && x < ctx->width);
+	assert(y >= ctx->top && y < ctx->height);
+	uint32_t base = x * 4 + (y - ctx->top) * ctx->stride;
+	ctx->buffer[base + 0] = v ? 255 : 0;
+	ctx->buffer[base + 1] = v ? 255 : 0;
+	ctx->buffer[base + 2] = v ? 255 : 0;
+	ctx->buffer[base + 3] = 255;
+}
+
+// Bresenham from (x0, y0) to (x1, y1), handing every fill-th pixel to put.
+// Inlined together with put, so every caller gets its own loop.
+static inline __attribute__((always_inline)) void line_walk(uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1, uint8_t fill, void (*put)(void *arg, uint16_t x, uint16_t y), void *arg) {
+	assert(x0 < 0xFFFF);
+	assert(x1 < 0xFFFF);
+	assert(y0 < 0xFFFF);
+	assert(y1 < 0xFFFF);
+	uint16_t dx = abs(x1-x0);
+	int8_t sx = x0<x1 ? 1 : -1;
+	int16_t dy = -abs(y1-y0);
+	int8_t sy = y0<y1 ? 1 : -1;
+	int16_t err = dx + dy;
+	uint8_t cnt = 0;
+
+	for(;;) {
+		if(cnt == 0) {
+			put(arg, x0, y0);
+		}
+		cnt = (cnt+1) % fill;
+		if(x0==x1 && y0==y1) break;
+		int16_t e2 = 2*err;
+		if(e2 >= dy) { err += dy; x0 += sx; }
+		if(e2 <= dx) { err += dx; y0 += sy; }
+	}
+}
+
+// The glyphs text() draws, 8x8 with the leftmost pixel in the low bit, for
+// the first 128 characters
+extern const char (*font)[8];
+
+// Immediate drawing, straight into the canvas
+void plotLine(struct RenderContext *ctx, uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1, uint8_t fill, uint8_t v);
+void text(char *str, uint8_t *pos, uint32_t stride);
+
+// Deferred drawing. Overlays are recorded into a draw list during the frame
+// and binned by the screen tiles they touch. draw_tiles() then goes tile by
+// tile, drawing the background and right after it, while the tile is still
+// in cache, the overlays clipped to it. Commands draw in the order they were
+// recorded, so the picture is the same as drawing them immediately. The
+// tiles are those of the canvas draw_tiles() gets, numbered along its rows.
+#define TILE_W 80
+#define TILE_H 48
+// The most tiles a canvas can have
+#define TILES (((MAX_WIDTH + TILE_W - 1) / TILE_W) * ((MAX_HEIGHT + TILE_H - 1) / TILE_H))
+
+// Overlays in a frame, enough for the kelp and entities on the widest
+// canvas and the rest
+#define DRAW_MAX 1024
+// Commands in a tile, added up over the tiles. Most overlays are small and
+// touch one or two, so this is a few per command.
+#define DRAW_BINNED (4 * DRAW_MAX)
+#define DRAW_TEXT_MAX 31
+// Text in a frame, which is only ever a line or two. It's kept apart from
+// the commands so they don't all carry room for it.
+#define DRAW_TEXT_BYTES (4 * (DRAW_TEXT_MAX + 1))
+
+// x1 and y1 are exclusive
+struct Rect {
+	uint16_t x0;
+	uint16_t y0;
+	uint16_t x1;
+	uint16_t y1;
+};
+
+enum DrawOp {
+	DRAW_LINE,
+	DRAW_TEXT,
+	DRAW_SPRITE,
+};
+
+struct Sprite;
+
+// 32 bytes, two to a cache line
+struct DrawCmd {
+	enum DrawOp op;
+	uint8_t fill;
+	uint8_t v;
+	// Where a DRAW_TEXT's string starts in the list's text
+	uint16_t text;
+	uint16_t x0;
+	uint16_t y0;
+	uint16_t x1;
+	uint16_t y1;
+	// The pixels it can touch, it's binned into the tiles these overlap
+	struct Rect bounds;
+	const struct Sprite *sprite;
+};
+
+struct DrawList {
+	uint16_t count;
+	struct DrawCmd cmds[DRAW_MAX];
+	uint16_t text_len;
+	char text[DRAW_TEXT_BYTES];
+	// Filled in by draw_tiles(): indices into cmds sorted by the tile of the
+	// canvas, in recording order within a tile, and where every tile's start
+	uint16_t start[TILES + 1];
+	uint16_t binned[DRAW_BINNED];
+};
+
+void draw_reset(struct DrawList *list);
+void draw_line(struct DrawList *list, uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1, uint8_t fill, uint8_t v);
+// White text with its top left corner at (x, y), at most DRAW_TEXT_MAX
+// characters
+void draw_text(struct DrawList *list, uint16_t x, uint16_t y, const char *str);
+// A sprite from sprite_get() anchored at (x, y), see sprite.h
+void draw_sprite(struct DrawList *list, const struct Sprite *sprite, uint16_t x, uint16_t y, uint8_t v);
+
+// Fill the tile with whatever goes under the overlays
+typedef void (*draw_background)(struct RenderContext *ctx, const struct Rect *tile, void *arg);
+// In band mode the tiles are cut to one band at a time instead, and the
+// backend gets each band before the next is drawn. That's always done on the
+// calling thread.
+void draw_tiles(struct DrawList *list, struct RenderContext *ctx, draw_background background, void *arg);
+
+// Set the canvas size for a display of at most fit_width x fit_height, which
+// is want_width x want_height unless FLIPPER_SIZE (like 800x480) asks for
+// another. It's cut to MAX_WIDTH x MAX_HEIGHT, and down to a multiple of 8
+// wide and 2 high for the 1bpp packers and the 2x2 blocks of the half
+// resolution quality level. Exits if FLIPPER_SIZE doesn't fit.
+void draw_size(struct RenderContext *ctx, uint32_t fit_width, uint32_t fit_height, uint32_t want_width, uint32_t want_height);
+
+// Rows per band from FLIPPER_BAND, rounded up to even so the 2x2 blocks of
+// the half resolution quality level stay in one band. 0 if it isn't set,
+// for a canvas of the whole frame.
+uint16_t draw_band_rows(const struct RenderContext *ctx);
+
+// Share the tiles of every frame with this many worker threads from now on.
+// Each worker calls init, if it isn't NULL, before it starts. Without it the
+// caller of draw_tiles() draws every tile itself.
+void draw_start(uint8_t threads, void (*init)(void));
+void draw_stop(void);
@@ -0,0 +1,514 @@
+#include "render.h"
+#include "draw.h"
+#include "input.h"
+#include "mem.h"
+#include "prof.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <drm_fourcc.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+// KMS output. The canvas is drawn straight into a dumb buffer, which is
+// handed to the display with a nonblocking atomic commit. The page flip event
+// tells us when it actually went out, and that's what paces the frame loop.
+//
+// Configured through the environment:
+//   FLIPPER_DRM          Card to use, otherwise the first one with a
+//                        connected output (vkms works for local testing)
+//   FLIPPER_DRM_BUFFERS  2 or 3 (default) buffers
+
+#define MAX_BUFFERS 3
+
+struct buffer {
+	uint32_t handle;
+	uint32_t fb_id;
+	uint32_t pitch;
+	uint64_t size;
+	uint8_t *map;
+	// prof_now() when it was committed
+	uint64_t committed;
+};
+
+struct props {
+	uint32_t conn_crtc_id;
+	uint32_t crtc_mode_id;
+	uint32_t crtc_active;
+	uint32_t plane_fb_id;
+	uint32_t plane_crtc_id;
+	uint32_t plane_src_x;
+	uint32_t plane_src_y;
+	uint32_t plane_src_w;
+	uint32_t plane_src_h;
+	uint32_t plane_crtc_x;
+	uint32_t plane_crtc_y;
+	uint32_t plane_crtc_w;
+	uint32_t plane_crtc_h;
+};
+
+struct drm {
+	int fd;
+	uint32_t conn_id;
+	uint32_t crtc_id;
+	uint32_t plane_id;
+	uint32_t mode_blob;
+	drmModeModeInfo mode;
+	drmModeCrtc *saved_crtc;
+	struct props props;
+
+	struct buffer buffers[MAX_BUFFERS];
+	uint8_t nbuffers;
+	// Where the canvas sits inside each buffer
+	size_t offset;
+
+	uint8_t back;
+	uint8_t front;
+	// Committed but not on screen yet, -1 if nothing is in flight
+	int8_t pending;
+
+	// Presentation stats
+	uint32_t presented;
+	uint32_t missed;
+	uint32_t last_seq;
+	uint64_t latency_sum;
+	uint64_t latency_max;
+};
+
+static uint32_t prop_id(int fd, uint32_t obj, uint32_t type, const char *name) {
+	uint32_t id = 0;
+	drmModeObjectProperties *props = drmModeObjectGetProperties(fd, obj, type);
+	if(props == NULL) {
+		return 0;
+	}
+	for(uint32_t i = 0; i < props->count_props && id == 0; i++) {
+		drmModePropertyRes *prop = drmModeGetProperty(fd, props->props[i]);
+		if(prop != NULL && strcmp(prop->name, name) == 0) {
+			id = prop->prop_id;
+		}
+		drmModeFreeProperty(prop);
+	}
+	drmModeFreeObjectProperties(props);
+
+	if(id == 0) {
+		fprintf(stderr, "DRM object %u has no %s property\n", obj, name);
+	}
+	return id;
+}
+
+static uint64_t prop_value(int fd, uint32_t obj, uint32_t type, const char *name) {
+	uint64_t value = 0;
+	drmModeObjectProperties *props = drmModeObjectGetProperties(fd, obj, type);
+	if(props == NULL) {
+		return 0;
+	}
+	for(uint32_t i = 0; i < props->count_props; i++) {
+		drmModePropertyRes *prop = drmModeGetProperty(fd, props->props[i]);
+		if(prop != NULL && strcmp(prop->name, name) == 0) {
+			value = props->prop_values[i];
+		}
+		drmModeFreeProperty(prop);
+	}
+	drmModeFreeObjectProperties(props);
+	return value;
+}
+
+// Pick the first connected connector, its preferred mode, a CRTC it can
+// drive and that CRTC's primary plane
+static bool find_output(struct drm *d) {
+	drmModeRes *res = drmModeGetResources(d->fd);
+	if(res == NULL) {
+		return false;
+	}
+
+	bool found = false;
+	for(int i = 0; i < res->count_connectors && !found; i++) {
+		drmModeConnector *conn = drmModeGetConnector(d->fd, res->connectors[i]);
+		if(conn == NULL) continue;
+		if(conn->connection != DRM_MODE_CONNECTED || conn->count_modes == 0) {
+			drmModeFreeConnector(conn);
+			continue;
+		}
+
+		d->mode = conn->modes[0];
+		for(int m = 0; m < conn->count_modes; m++) {
+			if(conn->modes[m].type & DRM_MODE_TYPE_PREFERRED) {
+				d->mode = conn->modes[m];
+				break;
+			}
+		}
+
+		for(int e = 0; e < conn->count_encoders && !found; e++) {
+			drmModeEncoder *enc = drmModeGetEncoder(d->fd, conn->encoders[e]);
+			if(enc == NULL) continue;
+			for(int c = 0; c < res->count_crtcs; c++) {
+				if(enc->possible_crtcs & (1 << c)) {
+					d->conn_id = conn->connector_id;
+					d->crtc_id = res->crtcs[c];
+					found = true;
+					break;
+				}
+			}
+			drmModeFreeEncoder(enc);
+		}
+		drmModeFreeConnector(conn);
+	}
+
+	uint32_t crtc_index = 0;
+	for(int c = 0; c < res->count_crtcs; c++) {
+		if(res->crtcs[c] == d->crtc_id) crtc_index = c;
+	}
+	drmModeFreeResources(res);
+	if(!found) {
+		return false;
+	}
+
+	drmModePlaneRes *planes = drmModeGetPlaneResources(d->fd);
+	if(planes == NULL) {
+		return false;
+	}
+	d->plane_id = 0;
+	for(uint32_t i = 0; i < planes->count_planes && d->plane_id == 0; i++) {
+		drmModePlane *plane = drmModeGetPlane(d->fd, planes->planes[i]);
+		if(plane == NULL) continue;
+		if((plane->possible_crtcs & (1 << crtc_index))
+				&& prop_value(d->fd, plane->plane_id, DRM_MODE_OBJECT_PLANE, "type") == DRM_PLANE_TYPE_PRIMARY) {
+			d->plane_id = plane->plane_id;
+		}
+		drmModeFreePlane(plane);
+	}
+	drmModeFreePlaneResources(planes);
+
+	return d->plane_id != 0;
+}
+
+static bool create_buffer(struct drm *d, struct buffer *b) {
+	struct drm_mode_create_dumb create = {
+		.width = d->mode.hdisplay,
+		.height = d->mode.vdisplay,
+		.bpp = 32,
+	};
+	if(drmIoctl(d->fd, DRM_IOCTL_MODE_CREATE_DUMB, &create) < 0) {
+		perror("DRM_IOCTL_MODE_CREATE_DUMB");
+		return false;
+	}
+	b->handle = create.handle;
+	b->pitch = create.pitch;
+	b->size = create.size;
+
+	uint32_t handles[4] = { b->handle };
+	uint32_t pitches[4] = { b->pitch };
+	uint32_t offsets[4] = { 0 };
+	if(drmModeAddFB2(d->fd, d->mode.hdisplay, d->mode.vdisplay, DRM_FORMAT_XRGB8888, handles, pitches, offsets, &b->fb_id, 0) < 0) {
+		perror("drmModeAddFB2");
+		return false;
+	}
+
+	struct drm_mode_map_dumb map = {
+		.handle = b->handle,
+	};
+	if(drmIoctl(d->fd, DRM_IOCTL_MODE_MAP_DUMB, &map) < 0) {
+		perror("DRM_IOCTL_MODE_MAP_DUMB");
+		return false;
+	}
+	b->map = mmap(0, b->size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, d->fd, map.offset);
+	if(b->map == MAP_FAILED) {
+		perror("Failed to map dumb buffer");
+		return false;
+	}
+
+	// The canvas doesn't cover the whole mode, the rest stays black
+	memset(b->map, 0, b->size);
+	prefault(b->map, b->size, true);
+	return true;
+}
+
+static void destroy_buffer(struct drm *d, struct buffer *b) {
+	munmap(b->map, b->size);
+	drmModeRmFB(d->fd, b->fb_id);
+	struct drm_mode_destroy_dumb destroy = {
+		.handle = b->handle,
+	};
+	drmIoctl(d->fd, DRM_IOCTL_MODE_DESTROY_DUMB, &destroy);
+}
+
+static void flip_handler(int fd, unsigned int seq, unsigned int sec, unsigned int usec, unsigned int crtc_id, void *data) {
+	struct drm *d = data;
+	assert(d->pending >= 0);
+
+	// The timestamp is the vblank the flip landed on, on the monotonic clock
+	uint64_t shown = sec * 1000000000ull + usec * 1000ull;
+	uint64_t committed = d->buffers[d->pending].committed;
+	uint64_t latency = shown > committed ? shown - committed : 0;
+	d->latency_sum += latency;
+	if(latency > d->latency_max) d->latency_max = latency;
+
+	if(d->presented > 0 && seq - d->last_seq > 1) {
+		d->missed += seq - d->last_seq - 1;
+	}
+	d->last_seq = seq;
+	d->presented++;
+
+	d->front = d->pending;
+	d->pending = -1;
+}
+
+static void wait_flip(struct drm *d) {
+	drmEventContext ev = {
+		.version = 3,
+		.page_flip_handler2 = flip_handler,
+	};
+	while(d->pending >= 0) {
+		struct pollfd pfd = {
+			.fd = d->fd,
+			.events = POLLIN,
+		};
+		int rc = poll(&pfd, 1, 1000);
+		if(rc < 0 && errno != EINTR) {
+			perror("poll");
+			abort();
+		} else if(rc == 0) {
+			fprintf(stderr, "Page flip timed out\n");
+			d->front = d->pending;
+			d->pending = -1;
+		} else if(rc > 0) {
+			drmHandleEvent(d->fd, &ev);
+		}
+	}
+}
+
+static bool modeset(struct drm *d, uint8_t buf) {
+	drmModeAtomicReq *req = drmModeAtomicAlloc();
+	const struct props *p = &d->props;
+
+	drmModeAtomicAddProperty(req, d->conn_id, p->conn_crtc_id, d->crtc_id);
+	drmModeAtomicAddProperty(req, d->crtc_id, p->crtc_mode_id, d->mode_blob);
+	drmModeAtomicAddProperty(req, d->crtc_id, p->crtc_active, 1);
+	drmModeAtomicAddProperty(req, d->plane_id, p->plane_fb_id, d->buffers[buf].fb_id);
+	drmModeAtomicAddProperty(req, d->plane_id, p->plane_crtc_id, d->crtc_id);
+	drmModeAtomicAddProperty(req, d->plane_id, p->plane_src_x, 0);
+	drmModeAtomicAddProperty(req, d->plane_id, p->plane_src_y, 0);
+	drmModeAtomicAddProperty(req, d->plane_id, p->plane_src_w, (uint64_t)d->mode.hdisplay << 16);
+	drmModeAtomicAddProperty(req, d->plane_id, p->plane_src_h, (uint64_t)d->mode.vdisplay << 16);
+	drmModeAtomicAddProperty(req, d->plane_id, p->plane_crtc_x, 0);
+	drmModeAtomicAddProperty(req, d->plane_id, p->plane_crtc_y, 0);
+	drmModeAtomicAddProperty(req, d->plane_id, p->plane_crtc_w, d->mode.hdisplay);
+	drmModeAtomicAddProperty(req, d->plane_id, p->plane_crtc_h, d->mode.vdisplay);
+
+	int rc = drmModeAtomicCommit(d->fd, req, DRM_MODE_ATOMIC_ALLOW_MODESET, NULL);
+	drmModeAtomicFree(req);
+	if(rc < 0) {
+		fprintf(stderr, "Modeset failed (%s)\n", strerror(-rc));
+		return false;
+	}
+	d->front = buf;
+	return true;
+}
+
+// The per frame flip goes straight to the ioctl. libdrm's atomic request
+// helpers allocate on every commit, and the frame loop must not.
+static bool flip(struct drm *d, uint8_t buf) {
+	struct buffer *b = &d->buffers[buf];
+	uint32_t objs[1] = { d->plane_id };
+	uint32_t count_props[1] = { 1 };
+	uint32_t props[1] = { d->props.plane_fb_id };
+	uint64_t values[1] = { b->fb_id };
+	struct drm_mode_atomic atomic = {
+		.flags = DRM_MODE_ATOMIC_NONBLOCK | DRM_MODE_PAGE_FLIP_EVENT,
+		.count_objs = 1,
+		.objs_ptr = (uintptr_t)objs,
+		.count_props_ptr = (uintptr_t)count_props,
+		.props_ptr = (uintptr_t)props,
+		.prop_values_ptr = (uintptr_t)values,
+		.user_data = (uintptr_t)d,
+	};
+
+	b->committed = prof_now();
+	if(drmIoctl(d->fd, DRM_IOCTL_MODE_ATOMIC, &atomic) < 0) {
+		perror("Atomic flip failed");
+		return false;
+	}
+	d->pending = buf;
+	return true;
+}
+
+static bool open_card(struct drm *d, const char *path) {
+	d->fd = open(path, O_RDWR | O_CLOEXEC);
+	if(d->fd < 0) {
+		return false;
+	}
+
+	uint64_t dumb = 0;
+	if(drmGetCap(d->fd, DRM_CAP_DUMB_BUFFER, &dumb) < 0 || !dumb
+			|| drmSetClientCap(d->fd, DRM_CLIENT_CAP_UNIVERSAL_PLANES, 1) < 0
+			|| drmSetClientCap(d->fd, DRM_CLIENT_CAP_ATOMIC, 1) < 0
+			|| !find_output(d)) {
+		close(d->fd);
+		d->fd = -1;
+		return false;
+	}
+
+	printf("DRM: %s, %ux%u@%u\n", path, d->mode.hdisplay, d->mode.vdisplay, d->mode.vrefresh);
+	return true;
+}
+
+void init_render(struct RenderContext *ctx) {
+	ctx->input = input_start();
+	prof_phase("input start");
+
+	struct drm *d = calloc(1, sizeof(struct drm));
+	assert(d != NULL);
+	d->fd = -1;
+	d->pending = -1;
+	ctx->drm = d;
+
+	const char *card = getenv("FLIPPER_DRM");
+	if(card != NULL) {
+		open_card(d, card);
+	} else {
+		for(uint8_t i = 0; i < 8 && d->fd < 0; i++) {
+			char path[32];
+			snprintf(path, sizeof(path), "/dev/dri/card%u", i);
+			open_card(d, path);
+		}
+	}
+	if(d->fd < 0) {
+		fprintf(stderr, "No usable DRM device\n");
+		exit(1);
+	}
+	draw_size(ctx, d->mode.hdisplay, d->mode.vdisplay, d->mode.hdisplay, d->mode.vdisplay);
+	printf("Mode is %ux%u, drawing %ux%u\n", d->mode.hdisplay, d->mode.vdisplay, ctx->width, ctx->height);
+
+	struct props *p = &d->props;
+	p->conn_crtc_id = prop_id(d->fd, d->conn_id, DRM_MODE_OBJECT_CONNECTOR, "CRTC_ID");
+	p->crtc_mode_id = prop_id(d->fd, d->crtc_id, DRM_MODE_OBJECT_CRTC, "MODE_ID");
+	p->crtc_active = prop_id(d->fd, d->crtc_id, DRM_MODE_OBJECT_CRTC, "ACTIVE");
+	p->plane_fb_id = prop_id(d->fd, d->plane_id, DRM_MODE_OBJECT_PLANE, "FB_ID");
+	p->plane_crtc_id = prop_id(d->fd, d->plane_id, DRM_MODE_OBJECT_PLANE, "CRTC_ID");
+	p->plane_src_x = prop_id(d->fd, d->plane_id, DRM_MODE_OBJECT_PLANE, "SRC_X");
+	p->plane_src_y = prop_id(d->fd, d->plane_id, DRM_MODE_OBJECT_PLANE, "SRC_Y");
+	p->plane_src_w = prop_id(d->fd, d->plane_id, DRM_MODE_OBJECT_PLANE, "SRC_W");
+	p->plane_src_h = prop_id(d->fd, d->plane_id, DRM_MODE_OBJECT_PLANE, "SRC_H");
+	p->plane_crtc_x = prop_id(d->fd, d->plane_id, DRM_MODE_OBJECT_PLANE, "CRTC_X");
+	p->plane_crtc_y = prop_id(d->fd, d->plane_id, DRM_MODE_OBJECT_PLANE, "CRTC_Y");
+	p->plane_crtc_w = prop_id(d->fd, d->plane_id, DRM_MODE_OBJECT_PLANE, "CRTC_W");
+	p->plane_crtc_h = prop_id(d->fd, d->plane_id, DRM_MODE_OBJECT_PLANE, "CRTC_H");
+	if(drmModeCreatePropertyBlob(d->fd, &d->mode, sizeof(d->mode), &d->mode_blob) < 0) {
+		perror("drmModeCreatePropertyBlob");
+		exit(1);
+	}
+	d->saved_crtc = drmModeGetCrtc(d->fd, d->crtc_id);
+	prof_phase("kms");
+
+	d->nbuffers = MAX_BUFFERS;
+	if(getenv("FLIPPER_DRM_BUFFERS") != NULL) {
+		d->nbuffers = atoi(getenv("FLIPPER_DRM_BUFFERS"));
+		if(d->nbuffers < 2) d->nbuffers = 2;
+		if(d->nbuffers > MAX_BUFFERS) d->nbuffers = MAX_BUFFERS;
+	}
+	for(uint8_t i = 0; i < d->nbuffers; i++) {
+		if(!create_buffer(d, &d->buffers[i])) {
+			exit(1);
+		}
+	}
+	prof_phase("buffers");
+
+	// Every buffer has the same pitch, so the canvas is at the same place
+	// in all of them
+	uint32_t pitch = d->buffers[0].pitch;
+	d->offset = (d->mode.vdisplay - ctx->height) / 2 * pitch + (d->mode.hdisplay - ctx->width) / 2 * 4;
+
+	if(!modeset(d, 0)) {
+		exit(1);
+	}
+	d->back = 1;
+	ctx->buffer = d->buffers[d->back].map + d->offset;
+	ctx->stride = pitch;
+	ctx->vsync = true;
+	prof_phase("modeset");
+
+	memset(ctx->keys, 0, KC_LAST * sizeof(uint8_t));
+
+	uint32_t wait = 1000;
+	if(getenv("FLIPPER_INPUT_WAIT") != NULL) {
+		wait = atoi(getenv("FLIPPER_INPUT_WAIT"));
+	}
+	if(!input_wait(ctx->input, wait)) {
+		fprintf(stderr, "No keyboard found yet, starting without one\n");
+	}
+	prof_phase("keyboard");
+}
+
+bool pump(struct RenderContext *ctx) {
+	input_poll(ctx->input, ctx->keys);
+	return true;
+}
+
+bool wait_input(struct RenderContext *ctx, uint32_t us) {
+	return input_sleep(ctx->input, us);
+}
+
+void render(struct RenderContext *ctx) {
+	struct drm *d = ctx->drm;
+
+	// Only one commit can be in flight, this is where we wait for vblank
+	wait_flip(d);
+	if(!flip(d, d->back)) {
+		return;
+	}
+
+	// Draw the next frame into whatever is neither on screen nor queued.
+	// With two buffers that only frees up once the flip is done.
+	for(;;) {
+		for(uint8_t i = 0; i < d->nbuffers; i++) {
+			if(i != d->front && i != d->pending) {
+				d->back = i;
+				ctx->buffer = d->buffers[d->back].map + d->offset;
+				return;
+			}
+		}
+		wait_flip(d);
+	}
+}
+
+void stop(struct RenderContext *ctx) {
+	struct drm *d = ctx->drm;
+	input_stop(ctx->input);
+	wait_flip(d);
+
+	if(d->presented > 0) {
+		printf(
+			"Presented %u frames, %u missed vblanks, commit to scanout avg %.2f ms max %.2f ms\n",
+			d->presented,
+			d->missed,
+			d->latency_sum / (double)d->presented / 1e6,
+			d->latency_max / 1e6
+		);
+	}
+
+	// Put back whatever was showing before us
+	if(d->saved_crtc != NULL) {
+		drmModeCrtc *c = d->saved_crtc;
+		if(c->mode_valid) {
+			drmModeSetCrtc(d->fd, c->crtc_id, c->buffer_id, c->x, c->y, &d->conn_id, 1, &c->mode);
+		} else {
+			drmModeSetCrtc(d->fd, c->crtc_id, 0, 0, 0, NULL, 0, NULL);
+		}
+		drmModeFreeCrtc(c);
+	}
+
+	for(uint8_t i = 0; i < d->nbuffers; i++) {
+		destroy_buffer(d, &d->buffers[i]);
+	}
+	drmModeDestroyPropertyBlob(d->fd, d->mode_blob);
+	close(d->fd);
+	free(d);
+}
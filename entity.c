@@ -0,0 +1,207 @@
+#include "entity.h"
+#include "fmath.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// How far one wanders from its anchor before turning around
+#define ENTITY_RANGE 512.0f
+// Steps of fleeing after a bump, at this many times the speed
+#define STARTLE_STEPS 60
+#define STARTLE_SPEED 3.0f
+// Entities whose bobbing goes through fsinf_n() together
+#define STEP_BLOCK 256
+
+#define ALIGN 64
+
+// Every per entity field, so allocating doesn't have to list them again
+#define FIELDS(F) \
+	F(x) F(y) F(velx) F(home) F(amp) F(phase) F(anchor) F(kind) F(radius) \
+	F(startled) F(bucket) F(sorted)
+
+static size_t field_bytes(size_t size, uint32_t count) {
+	return (size * count + ALIGN - 1) / ALIGN * ALIGN;
+}
+
+bool entity_alloc(struct Entities *e, uint32_t capacity) {
+	uint32_t buckets = 64;
+	while(buckets < capacity) {
+		buckets *= 2;
+	}
+	size_t len = field_bytes(sizeof(*e->start), buckets + 1);
+#define SIZE(f) len += field_bytes(sizeof(*e->f), capacity);
+	FIELDS(SIZE)
+#undef SIZE
+	uint8_t *p = aligned_alloc(ALIGN, len);
+	if(p == NULL) {
+		return false;
+	}
+	memset(p, 0, len);
+	e->count = 0;
+	e->capacity = capacity;
+	e->buckets = buckets;
+	e->start = (void *)p;
+	p += field_bytes(sizeof(*e->start), buckets + 1);
+#define CARVE(f) e->f = (void *)p; p += field_bytes(sizeof(*e->f), capacity);
+	FIELDS(CARVE)
+#undef CARVE
+	return true;
+}
+
+void entity_free(struct Entities *e) {
+	free(e->start);
+	memset(e, 0, sizeof(*e));
+}
+
+static const uint8_t radii[ENTITY_KINDS] = {
+	[ENTITY_FISH] = 5,
+	[ENTITY_BUOY] = 6,
+	[ENTITY_BIRD] = 5,
+};
+
+bool entity_add(struct Entities *e, uint8_t kind, float x, float y, float velx, float amp, float phase) {
+	if(e->count >= e->capacity) {
+		return false;
+	}
+	uint32_t i = e->count++;
+	e->x[i] = x;
+	e->y[i] = y;
+	e->velx[i] = velx;
+	e->home[i] = y;
+	e->amp[i] = amp;
+	e->phase[i] = phase;
+	e->anchor[i] = x;
+	e->kind[i] = kind;
+	e->radius[i] = radii[kind];
+	e->startled[i] = 0;
+	return true;
+}
+
+void entity_step(struct Entities *e, float t) {
+	float arg[STEP_BLOCK], s[STEP_BLOCK];
+	for(uint32_t first = 0; first < e->count; first += STEP_BLOCK) {
+		uint32_t n = e->count - first < STEP_BLOCK ? e->count - first : STEP_BLOCK;
+		const float *phases = e->phase + first, *homes = e->home + first, *amps = e->amp + first, *anchors = e->anchor + first;
+		float *xs = e->x + first, *ys = e->y + first, *velxs = e->velx + first;
+		uint8_t *startleds = e->startled + first;
+
+		for(uint32_t i = 0; i < n; i++) {
+			arg[i] = t * 2.0f + phases[i];
+		}
+		fsinf_n(s, arg, n);
+
+		// The fields never overlap
+#pragma GCC ivdep
+		for(uint32_t i = 0; i < n; i++) {
+			float velx = velxs[i];
+			float x = xs[i] + velx * (startleds[i] ? STARTLE_SPEED : 1.0f);
+			float away = x - anchors[i];
+			bool turn = (away > ENTITY_RANGE && velx > 0.0f) || (away < -ENTITY_RANGE && velx < 0.0f);
+			velxs[i] = turn ? -velx : velx;
+			xs[i] = x;
+			ys[i] = homes[i] + amps[i] * s[i];
+			startleds[i] = startleds[i] ? startleds[i] - 1 : 0;
+		}
+	}
+	entity_build(e);
+}
+
+void entity_startle(struct Entities *e, uint32_t i, float x) {
+	e->startled[i] = STARTLE_STEPS;
+	e->velx[i] = e->x[i] < x ? -fabsf(e->velx[i]) : fabsf(e->velx[i]);
+	e->anchor[i] = e->x[i];
+}
+
+static inline int32_t cell(float v) {
+	return floorf(v / ENTITY_CELL);
+}
+
+static inline uint32_t hash_cell(const struct Entities *e, int32_t cx, int32_t cy) {
+	return ((uint32_t)cx * 73856093u ^ (uint32_t)cy * 19349663u) & (e->buckets - 1);
+}
+
+// A counting sort by bucket. Scattering moves every bucket's start up to
+// the next one's, so they're moved back after.
+void entity_build(struct Entities *e) {
+	memset(e->start, 0, (e->buckets + 1) * sizeof(*e->start));
+	for(uint32_t i = 0; i < e->count; i++) {
+		e->bucket[i] = hash_cell(e, cell(e->x[i]), cell(e->y[i]));
+		e->start[e->bucket[i] + 1]++;
+	}
+	for(uint32_t b = 0; b < e->buckets; b++) {
+		e->start[b + 1] += e->start[b];
+	}
+	for(uint32_t i = 0; i < e->count; i++) {
+		e->sorted[e->start[e->bucket[i]]++] = i;
+	}
+	memmove(e->start + 1, e->start, e->buckets * sizeof(*e->start));
+	e->start[0] = 0;
+}
+
+static inline bool overlaps(const struct Entities *e, uint32_t i, float x0, float y0, float x1, float y1) {
+	float dx = e->x[i] - fmaxf(x0, fminf(e->x[i], x1));
+	float dy = e->y[i] - fmaxf(y0, fminf(e->y[i], y1));
+	float r = e->radius[i];
+	return dx * dx + dy * dy <= r * r;
+}
+
+uint32_t entity_query_all(const struct Entities *e, float x0, float y0, float x1, float y1, uint32_t *out, uint32_t max) {
+	uint32_t n = 0;
+	for(uint32_t i = 0; i < e->count; i++) {
+		if(overlaps(e, i, x0, y0, x1, y1)) {
+			if(n < max) out[n] = i;
+			n++;
+		}
+	}
+	return n;
+}
+
+uint32_t entity_query(const struct Entities *e, float x0, float y0, float x1, float y1, uint32_t *out, uint32_t max) {
+	// An entity is in the cell of its center, which can be up to
+	// ENTITY_RADIUS_MAX outside the rectangle
+	int32_t cx0 = cell(x0 - ENTITY_RADIUS_MAX), cx1 = cell(x1 + ENTITY_RADIUS_MAX);
+	int32_t cy0 = cell(y0 - ENTITY_RADIUS_MAX), cy1 = cell(y1 + ENTITY_RADIUS_MAX);
+	// Covering more cells than there are buckets goes over some buckets
+	// more than once, looking at everything is cheaper
+	if((int64_t)(cx1 - cx0 + 1) * (cy1 - cy0 + 1) > e->buckets) {
+		return entity_query_all(e, x0, y0, x1, y1, out, max);
+	}
+
+	uint32_t n = 0;
+	for(int32_t cy = cy0; cy <= cy1; cy++) {
+		for(int32_t cx = cx0; cx <= cx1; cx++) {
+			uint32_t b = hash_cell(e, cx, cy);
+			for(uint32_t k = e->start[b]; k < e->start[b + 1]; k++) {
+				uint32_t i = e->sorted[k];
+				// Other cells share the bucket
+				if(cell(e->x[i]) != cx || cell(e->y[i]) != cy) {
+					continue;
+				}
+				if(overlaps(e, i, x0, y0, x1, y1)) {
+					if(n < max) out[n] = i;
+					n++;
+				}
+			}
+		}
+	}
+	return n;
+}
+
+uint32_t entity_touching(const struct Entities *e, float x, float y, float r, uint32_t *out, uint32_t max) {
+	// Whatever overlaps the circle's box, then the ones that overlap the
+	// circle itself
+	uint32_t near[64];
+	uint32_t found = entity_query(e, x - r, y - r, x + r, y + r, near, 64);
+	if(found > 64) found = 64;
+	uint32_t n = 0;
+	for(uint32_t k = 0; k < found; k++) {
+		uint32_t i = near[k];
+		float dx = e->x[i] - x, dy = e->y[i] - y, reach = r + e->radius[i];
+		if(dx * dx + dy * dy <= reach * reach) {
+			if(n < max) out[n] = i;
+			n++;
+		}
+	}
+	return n;
+}
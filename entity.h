@@ -0,0 +1,82 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Everything in the sea and the sky besides the dolphin: schools of fish,
+// buoys and birds. They're kept as a struct of arrays like sim.h's dolphins,
+// entity i being index i of every field, so a step goes over a field at a
+// time.
+//
+// What's near a point is found through a uniform grid of ENTITY_CELL square
+// cells over the world, hashed into buckets: entity_build() sorts the
+// entities by bucket, and a query only looks at the buckets of the cells it
+// covers. That's how a frame finds the few entities on the screen and the
+// ones touching the dolphin out of thousands.
+
+// A cell is at least as big as any entity, so one touches at most the cells
+// next to its own
+#define ENTITY_CELL 64
+#define ENTITY_RADIUS_MAX 16
+
+enum EntityKind {
+	ENTITY_FISH,
+	ENTITY_BUOY,
+	ENTITY_BIRD,
+	ENTITY_KINDS,
+};
+
+struct Entities {
+	uint32_t count;
+	uint32_t capacity;
+
+	// World position, y up from the surface like the dolphin's
+	float *x;
+	float *y;
+	float *velx;
+	// Bobbing: y is home plus amp times the sine of the game time plus
+	// phase
+	float *home;
+	float *amp;
+	float *phase;
+	// Where it's from, it turns around once it's ENTITY_RANGE away
+	float *anchor;
+	uint8_t *kind;
+	uint8_t *radius;
+	// Steps left of fleeing faster, after the dolphin bumped into it
+	uint8_t *startled;
+
+	// The hash: bucket is each entity's bucket at the last entity_build(),
+	// sorted the entities in bucket order, and start where each bucket's
+	// entities start in it
+	uint32_t buckets;
+	uint32_t *bucket;
+	uint32_t *sorted;
+	uint32_t *start;
+};
+
+// Room for capacity entities, with as many buckets as the next power of two
+// up. False if there's no memory for it.
+bool entity_alloc(struct Entities *e, uint32_t capacity);
+void entity_free(struct Entities *e);
+// A new entity of kind at (x, y), at the end. False if it's full.
+bool entity_add(struct Entities *e, uint8_t kind, float x, float y, float velx, float amp, float phase);
+
+// One step of every entity at game time t, and the hash built again for
+// where they are now
+void entity_step(struct Entities *e, float t);
+void entity_build(struct Entities *e);
+
+// Up to max entities whose circle overlaps the rectangle x0 to x1, y0 to y1,
+// into out. The number of them, which can be more than max.
+uint32_t entity_query(const struct Entities *e, float x0, float y0, float x1, float y1, uint32_t *out, uint32_t max);
+// The same as entity_query(), by looking at every entity, to check it
+// against
+uint32_t entity_query_all(const struct Entities *e, float x0, float y0, float x1, float y1, uint32_t *out, uint32_t max);
+// Up to max entities whose circle overlaps the circle of radius r at (x, y),
+// out of the first 64 whose circle overlaps its box
+uint32_t entity_touching(const struct Entities *e, float x, float y, float r, uint32_t *out, uint32_t max);
+
+// The dolphin bumped into entity i from x, it flees the other way for a bit
+void entity_startle(struct Entities *e, uint32_t i, float x);
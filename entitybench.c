@@ -0,0 +1,102 @@
+#include "bench.h"
+#include "entity.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// What the entities cost a frame at thousands of them: stepping them,
+// hashing them, finding the ones on a 400x240 screen and the ones touching
+// the dolphin. step hashes them again too, and "frame" is what the game
+// does a frame: step, cull and collide. "scan" finds the ones on the screen
+// by looking at every one, which is what the hash is up against. A frame
+// has to stay under 2 ms on the board.
+
+#define SCREEN_W 400
+#define SCREEN_H 240
+
+struct Job {
+	struct Entities e;
+	float t;
+	// The camera, going along with the entities
+	float x;
+	float y;
+	uint32_t out[4096];
+	uint32_t found;
+};
+
+static void step(void *arg) {
+	struct Job *job = arg;
+	job->t += 0.01667f;
+	entity_step(&job->e, job->t);
+}
+
+static void build(void *arg) {
+	struct Job *job = arg;
+	entity_build(&job->e);
+}
+
+static void cull(void *arg) {
+	struct Job *job = arg;
+	job->x += 7.0f;
+	job->found = entity_query(&job->e, job->x, job->y - SCREEN_H, job->x + SCREEN_W, job->y, job->out, 4096);
+}
+
+static void scan(void *arg) {
+	struct Job *job = arg;
+	job->x += 7.0f;
+	job->found = entity_query_all(&job->e, job->x, job->y - SCREEN_H, job->x + SCREEN_W, job->y, job->out, 4096);
+}
+
+static void collide(void *arg) {
+	struct Job *job = arg;
+	job->x += 7.0f;
+	job->found = entity_touching(&job->e, job->x + SCREEN_W/2, job->y - SCREEN_H/2, 15.0f, job->out, 16);
+}
+
+int main(int argc, char *argv[]) {
+	static const uint32_t counts[] = { 1024, 4096, 16384, 65536 };
+	static const struct {
+		const char *name;
+		void (*fn)(void *arg);
+		bool frame;
+	} ops[] = {
+		{ "step", step, true },
+		{ "build", build, false },
+		{ "cull", cull, true },
+		{ "scan", scan, false },
+		{ "collide", collide, true },
+	};
+
+	printf("%-8s %8s %12s %10s\n", "op", "entities", "us/frame", "found");
+	for(size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+		static struct Job job;
+		if(!entity_alloc(&job.e, counts[c])) {
+			fprintf(stderr, "Failed to allocate %u entities\n", counts[c]);
+			return 1;
+		}
+		// Spread like the game spreads them, 16 columns each, from the
+		// seabed up into the sky
+		srand(1);
+		for(uint32_t i = 0; i < counts[c]; i++) {
+			float x = (rand() / (float)RAND_MAX - 0.5f) * counts[c] * 16.0f;
+			float y = -480.0f + rand() / (float)RAND_MAX * 800.0f;
+			float velx = (rand() / (float)RAND_MAX - 0.5f) * 2.0f;
+			entity_add(&job.e, i % 3, x, y, velx, 3.0f, rand() / (float)RAND_MAX * M_PI*2);
+		}
+		entity_build(&job.e);
+
+		double frame_ns = 0.0;
+		for(size_t o = 0; o < sizeof(ops) / sizeof(ops[0]); o++) {
+			job.x = -SCREEN_W/2;
+			job.y = 0.0f;
+			job.found = 0;
+			struct BenchResult r = bench_run(ops[o].fn, &job, 10, 200);
+			printf("%-8s %8u %12.2f %10u\n", ops[o].name, counts[c], r.mean_ns / 1e3, job.found);
+			frame_ns += ops[o].frame ? r.mean_ns : 0.0;
+		}
+		printf("%-8s %8u %12.2f\n", "frame", counts[c], frame_ns / 1e3);
+		entity_free(&job.e);
+	}
+	return 0;
+}
@@ -1,38 +1,56 @@
 #include "render.h"
+#include "convert.h"
+#include "draw.h"
+#include "input.h"
+#include "mem.h"
+#include "prof.h"
 
 #include <assert.h>
-#include <libevdev/libevdev.h>
 #include <fcntl.h>
 #include <errno.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/ioctl.h>
 #include <sys/mman.h>
 
 #include <linux/fb.h>
 #include <linux/kd.h>
 #include <linux/vt.h>
 
-void init_render(struct RenderContext *ctx) {
-	ctx->prev_tty = 0;
+// 8bpp panels with a palette get a gray ramp, so the value we write is the
+// brightness like on the true color ones
+static void set_gray_cmap(int fbfd) {
+	uint16_t ramp[256];
+	for(uint16_t i = 0; i < 256; i++) {
+		ramp[i] = i * 257;
+	}
+	struct fb_cmap cmap = {
+		.start = 0,
+		.len = 256,
+		.red = ramp,
+		.green = ramp,
+		.blue = ramp,
+		.transp = NULL,
+	};
+	if(ioctl(fbfd, FBIOPUTCMAP, &cmap) < 0) {
+		perror("FBIOPUTCMAP");
+	}
+}
 
-	int fd = open("/dev/input/event1", O_RDONLY|O_NONBLOCK);
-	int rc = libevdev_new_from_fd(fd, &ctx->dev);
-	if (rc < 0) {
-		fprintf(stderr, "Failed to init libevdev (%s)\n", strerror(-rc));
-		exit(1);
+static void fb_band(struct RenderContext *ctx, uint16_t y0, uint16_t y1) {
+	for(uint16_t y = y0; y < y1; y++) {
+		ctx->convert->row(ctx->fbuffer + y * ctx->fbstride, ctx->buffer + (y - y0) * ctx->stride, ctx->width);
 	}
+}
 
-	printf("Input device name: \"%s\"\n", libevdev_get_name(ctx->dev));
-	printf(
-		"Input device ID: bus %#x vendor %#x product %#x\n",
-		libevdev_get_id_bustype(ctx->dev),
-		libevdev_get_id_vendor(ctx->dev),
-		libevdev_get_id_product(ctx->dev)
-	);
+void init_render(struct RenderContext *ctx) {
+	ctx->prev_tty = 0;
 
-	sleep(1);
+	// Discovery runs on the input thread while we bring up the display
+	ctx->input = input_start();
+	prof_phase("input start");
 
 	{
 		ctx->ttyfd = open("/dev/tty0", O_RDWR);
@@ -81,6 +99,7 @@ void init_render(struct RenderContext *ctx) {
 			goto fail;
 		}
 	}
+	prof_phase("vt");
 
 	int fbfd = open("/dev/fb0", O_RDWR);
 	if(fbfd < 0) {
@@ -88,20 +107,87 @@ void init_render(struct RenderContext *ctx) {
 		goto fail;
 	}
 
-#ifndef NDEBUG
 	struct fb_var_screeninfo vinfo;
-	ioctl(fbfd, FBIOGET_VSCREENINFO, &vinfo);
-	assert(vinfo.xres == WIDTH);
-	assert(vinfo.yres == HEIGHT);
-	assert(vinfo.bits_per_pixel == 32);
-#endif
+	struct fb_fix_screeninfo finfo;
+	if(ioctl(fbfd, FBIOGET_VSCREENINFO, &vinfo) < 0 || ioctl(fbfd, FBIOGET_FSCREENINFO, &finfo) < 0) {
+		perror("FBIOGET_SCREENINFO");
+		goto fail;
+	}
+	// As much of the framebuffer as we can fill, from the top left
+	draw_size(ctx, vinfo.xres, vinfo.yres, vinfo.xres, vinfo.yres);
+
+	// Write the panel's own format rather than making the driver (or the
+	// panel) eat 32 bits per pixel
+	enum PixelFormat format;
+	switch(vinfo.bits_per_pixel) {
+		case 32:
+			format = PF_XRGB8888;
+			break;
+		case 16:
+			format = PF_RGB565;
+			break;
+		case 8:
+			format = PF_GRAY8;
+			if(finfo.visual == FB_VISUAL_PSEUDOCOLOR) {
+				set_gray_cmap(fbfd);
+			}
+			break;
+		case 1:
+			format = finfo.visual == FB_VISUAL_MONO01 ? PF_MONO01 : PF_MONO10;
+			break;
+		default:
+			fprintf(stderr, "Unsupported framebuffer depth %ubpp\n", vinfo.bits_per_pixel);
+			goto fail;
+	}
+	ctx->convert = convert_find(format);
+	ctx->fbstride = finfo.line_length;
+	ctx->fbsize = (size_t)finfo.line_length * vinfo.yres;
+	printf(
+		"Framebuffer: %ux%u %ubpp, drawing %ux%u, using %s, %zu bytes per frame\n",
+		vinfo.xres, vinfo.yres, vinfo.bits_per_pixel,
+		ctx->width, ctx->height,
+		ctx->convert->name,
+		convert_row_bytes(ctx->convert, ctx->width) * ctx->height
+	);
 
 	ioctl(fbfd, KDSETMODE, KD_GRAPHICS);
-	ctx->fbuffer = mmap(0, WIDTH * HEIGHT * 4, PROT_READ | PROT_WRITE, MAP_SHARED, fbfd, (off_t)0);
-	ctx->buffer = malloc(WIDTH * HEIGHT * 4);
+	ctx->fbfd = fbfd;
+	ctx->fbuffer = mmap(0, ctx->fbsize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fbfd, (off_t)0);
+	if(ctx->fbuffer == MAP_FAILED) {
+		fprintf(stderr, "Failed to map framebuffer (%m)\n");
+		goto fail;
+	}
+	prefault(ctx->fbuffer, ctx->fbsize, true);
+	prof_phase("fb");
+
+	// In band mode only a band of the canvas exists, and every band goes
+	// to the framebuffer as soon as it's drawn
+	ctx->band_rows = draw_band_rows(ctx);
+	uint16_t rows = ctx->band_rows != 0 ? ctx->band_rows : ctx->height;
+	if(ctx->band_rows != 0) {
+		ctx->band = fb_band;
+		printf("Drawing in bands of %u rows, %u bytes\n", rows, ctx->width * rows * 4);
+	}
+	ctx->buffer = mem_alloc(ctx->width * rows * 4);
 	assert(ctx->buffer != NULL);
+	prefault(ctx->buffer, ctx->width * rows * 4, true);
+	ctx->stride = ctx->width * 4;
+	ctx->vsync = false;
+	prof_phase("canvas");
 
 	memset(ctx->keys, 0, KC_LAST * sizeof(uint8_t));
+
+	// Give a keyboard that's still being probed a moment to show up, but
+	// don't hold the first frame hostage for one that never will. Hotplug
+	// still picks it up later.
+	uint32_t wait = 1000;
+	if(getenv("FLIPPER_INPUT_WAIT") != NULL) {
+		wait = atoi(getenv("FLIPPER_INPUT_WAIT"));
+	}
+	if(!input_wait(ctx->input, wait)) {
+		fprintf(stderr, "No keyboard found yet, starting without one\n");
+	}
+	prof_phase("keyboard");
 	return;
 
 fail:
@@ -110,49 +196,27 @@ fail:
 }
 
 bool pump(struct RenderContext *ctx) {
-	int rc = 1;
-
-	do {
-		struct input_event ev;
-		rc = libevdev_next_event(ctx->dev, LIBEVDEV_READ_FLAG_NORMAL, &ev);
-		if (rc == 0) {
-			/* printf( */
-			/* 	"Event: %s %s %d\n", */
-			/* 	libevdev_event_type_get_name(ev.type), */
-			/* 	libevdev_event_code_get_name(ev.type, ev.code), */
-			/* 	ev.value */
-			/* ); */
-			if(ev.type == EV_KEY) {
-				switch(ev.code) {
-					case KEY_D:
-						ctx->keys[KC_LEFT] = ev.value;
-						break;
-					case KEY_K:
-						ctx->keys[KC_RIGHT] = ev.value;
-						break;
-					case KEY_SPACE:
-						ctx->keys[KC_UP] = ev.value;
-						break;
-					case KEY_ESC:
-						ctx->keys[KC_ESC] = ev.value;
-						break;
-				}
-			}
-		}
-	} while (rc == 1 || rc == 0);
-	
+	input_poll(ctx->input, ctx->keys);
 	return true;
 }
 
+bool wait_input(struct RenderContext *ctx, uint32_t us) {
+	return input_sleep(ctx->input, us);
+}
+
 void render(struct RenderContext *ctx) {
-	memcpy(ctx->fbuffer, ctx->buffer, WIDTH * HEIGHT * 4);
+	if(ctx->band_rows == 0) {
+		fb_band(ctx, 0, ctx->height);
+	}
 }
 
 void stop(struct RenderContext *ctx) {
-	memset(ctx->fbuffer, 0, WIDTH*HEIGHT*4);
-	munmap(ctx->fbuffer, WIDTH*HEIGHT*4);
+	input_stop(ctx->input);
+
+	memset(ctx->fbuffer, 0, ctx->fbsize);
+	munmap(ctx->fbuffer, ctx->fbsize);
 	close(ctx->fbfd);
-	free(ctx->buffer);
+	mem_free(ctx->buffer);
 
 	// Shouldn't this be saved when opened too?
 	if (ioctl(ctx->ttyfd, KDSETMODE, KD_TEXT) < 0) {
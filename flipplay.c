@@ -0,0 +1,276 @@
+#include "record.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Turns a FLIPPER_RECORD recording back into a PBM or PNG per frame, or
+// with -i just describes it.
+
+static uint32_t crc_table[256];
+
+static void crc_init(void) {
+	for(uint32_t n = 0; n < 256; n++) {
+		uint32_t c = n;
+		for(uint8_t k = 0; k < 8; k++) {
+			c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+		}
+		crc_table[n] = c;
+	}
+}
+
+static uint32_t crc(uint32_t c, const uint8_t *buf, size_t len) {
+	c ^= 0xFFFFFFFF;
+	for(size_t i = 0; i < len; i++) {
+		c = crc_table[(c ^ buf[i]) & 0xFF] ^ (c >> 8);
+	}
+	return c ^ 0xFFFFFFFF;
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+static void png_chunk(FILE *f, const char *type, const uint8_t *data, uint32_t len) {
+	uint8_t head[8];
+	put32(head, len);
+	memcpy(head + 4, type, 4);
+	uint32_t c = crc(0, head + 4, 4);
+	if(len > 0) c = crc(c, data, len);
+	uint8_t tail[4];
+	put32(tail, c);
+	fwrite(head, 1, 8, f);
+	if(len > 0) fwrite(data, 1, len, f);
+	fwrite(tail, 1, 4, f);
+}
+
+// 1 bit grayscale, white is 1 just like the recording. We don't have zlib,
+// so the image data goes in stored (uncompressed) deflate blocks.
+static void write_png(FILE *f, const uint8_t *frame, uint16_t width, uint16_t height) {
+	static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+	fwrite(signature, 1, 8, f);
+
+	uint8_t ihdr[13] = {0};
+	put32(ihdr, width);
+	put32(ihdr + 4, height);
+	ihdr[8] = 1;
+	png_chunk(f, "IHDR", ihdr, sizeof(ihdr));
+
+	size_t row = width / 8;
+	size_t raw_len = (row + 1) * height;
+	uint8_t *raw = malloc(raw_len);
+	for(uint16_t y = 0; y < height; y++) {
+		raw[y * (row + 1)] = 0;
+		memcpy(raw + y * (row + 1) + 1, frame + y * row, row);
+	}
+
+	size_t blocks = (raw_len + 65534) / 65535;
+	uint8_t *z = malloc(2 + raw_len + blocks * 5 + 4);
+	size_t o = 0;
+	z[o++] = 0x78;
+	z[o++] = 0x01;
+	for(size_t i = 0; i < raw_len; i += 65535) {
+		uint16_t n = raw_len - i < 65535 ? raw_len - i : 65535;
+		z[o++] = i + n == raw_len;
+		z[o++] = n & 0xFF;
+		z[o++] = n >> 8;
+		z[o++] = ~n & 0xFF;
+		z[o++] = ~n >> 8;
+		memcpy(z + o, raw + i, n);
+		o += n;
+	}
+	uint32_t a = 1, b = 0;
+	for(size_t i = 0; i < raw_len; i++) {
+		a = (a + raw[i]) % 65521;
+		b = (b + a) % 65521;
+	}
+	put32(z + o, (b << 16) | a);
+	o += 4;
+
+	png_chunk(f, "IDAT", z, o);
+	png_chunk(f, "IEND", NULL, 0);
+	free(z);
+	free(raw);
+}
+
+static void write_pbm(FILE *f, const uint8_t *frame, uint16_t width, uint16_t height) {
+	// PBM has 1 as black
+	fprintf(f, "P4\n%u %u\n", width, height);
+	for(size_t i = 0; i < (size_t)width / 8 * height; i++) {
+		fputc(frame[i] ^ 0xFF, f);
+	}
+}
+
+// Offsets of every frame, from the index chain if the recording was closed
+// properly and by walking the chunks if not
+static uint64_t *load_offsets(FILE *f, uint32_t *count) {
+	struct RecordFooter footer;
+	fseek(f, -(long)sizeof(footer), SEEK_END);
+	uint64_t *offsets = NULL;
+	if(fread(&footer, sizeof(footer), 1, f) == 1 && footer.magic == RECORD_INDEX_MAGIC) {
+		offsets = calloc(footer.frames ? footer.frames : 1, sizeof(uint64_t));
+		for(uint64_t at = footer.index; at != 0;) {
+			struct RecordChunk chunk;
+			uint64_t prev;
+			fseek(f, at, SEEK_SET);
+			if(fread(&chunk, sizeof(chunk), 1, f) != 1 || chunk.type != 'I' || fread(&prev, sizeof(prev), 1, f) != 1) {
+				break;
+			}
+			uint32_t n = (chunk.length - sizeof(prev)) / sizeof(uint64_t);
+			if(chunk.frame + n > footer.frames) {
+				break;
+			}
+			if(fread(offsets + chunk.frame, sizeof(uint64_t), n, f) != n) {
+				break;
+			}
+			at = prev;
+		}
+		*count = footer.frames;
+		return offsets;
+	}
+
+	uint32_t cap = 1024;
+	*count = 0;
+	offsets = malloc(cap * sizeof(uint64_t));
+	fseek(f, sizeof(struct RecordHeader), SEEK_SET);
+	for(struct RecordChunk chunk; fread(&chunk, sizeof(chunk), 1, f) == 1;) {
+		if(chunk.type == 'F') {
+			if(*count == cap) {
+				cap *= 2;
+				offsets = realloc(offsets, cap * sizeof(uint64_t));
+			}
+			offsets[(*count)++] = ftell(f) - sizeof(chunk);
+		}
+		if(fseek(f, chunk.length, SEEK_CUR) < 0) {
+			break;
+		}
+	}
+	return offsets;
+}
+
+int main(int argc, char *argv[]) {
+	const char *prefix = "frame";
+	const char *type = "pbm";
+	uint32_t first = 0;
+	uint32_t limit = UINT32_MAX;
+	bool info = false;
+
+	for(int opt; (opt = getopt(argc, argv, "io:t:f:n:")) != -1;) {
+		switch(opt) {
+			case 'i':
+				info = true;
+				break;
+			case 'o':
+				prefix = optarg;
+				break;
+			case 't':
+				type = optarg;
+				break;
+			case 'f':
+				first = atoi(optarg);
+				break;
+			case 'n':
+				limit = atoi(optarg);
+				break;
+			default:
+				goto usage;
+		}
+	}
+	if(optind != argc - 1 || (strcmp(type, "pbm") != 0 && strcmp(type, "png") != 0)) {
+		goto usage;
+	}
+
+	FILE *f = fopen(argv[optind], "rb");
+	struct RecordHeader header;
+	if(f == NULL || fread(&header, sizeof(header), 1, f) != 1 || header.magic != RECORD_MAGIC || header.version != RECORD_VERSION) {
+		fprintf(stderr, "%s is not a recording\n", argv[optind]);
+		return 1;
+	}
+
+	uint32_t count;
+	uint64_t *offsets = load_offsets(f, &count);
+	size_t frame_bytes = (size_t)header.width / 8 * header.height;
+	uint8_t *frame = calloc(1, frame_bytes);
+	uint8_t *delta = malloc(frame_bytes);
+	uint8_t *payload = malloc(RECORD_MAX_PAYLOAD(frame_bytes));
+	crc_init();
+
+	// Decoding has to start at a key frame
+	uint32_t start = first < count ? first : count;
+	while(start > 0 && start % RECORD_KEYFRAME_INTERVAL != 0) {
+		start--;
+	}
+
+	uint64_t total = 0;
+	uint64_t duration = 0;
+	uint32_t keys = 0;
+	for(uint32_t i = info ? 0 : start; i < count && (i < first || i - first < limit); i++) {
+		struct RecordChunk chunk;
+		fseek(f, offsets[i], SEEK_SET);
+		if(fread(&chunk, sizeof(chunk), 1, f) != 1 || chunk.type != 'F' || chunk.length > RECORD_MAX_PAYLOAD(frame_bytes)
+				|| fread(payload, 1, chunk.length, f) != chunk.length) {
+			fprintf(stderr, "Recording is truncated at frame %u\n", i);
+			break;
+		}
+		total += sizeof(chunk) + chunk.length;
+		duration = chunk.time;
+		if(chunk.flags & RECORD_FLAG_KEY) keys++;
+		if(info) {
+			continue;
+		}
+
+		if(!record_rle_decode(delta, frame_bytes, payload, chunk.length)) {
+			fprintf(stderr, "Frame %u is corrupt\n", i);
+			break;
+		}
+		if(chunk.flags & RECORD_FLAG_KEY) {
+			memcpy(frame, delta, frame_bytes);
+		} else {
+			for(size_t b = 0; b < frame_bytes; b++) {
+				frame[b] ^= delta[b];
+			}
+		}
+
+		if(i < first) {
+			continue;
+		}
+		char path[256];
+		snprintf(path, sizeof(path), "%s%06u.%s", prefix, i, type);
+		FILE *out = fopen(path, "wb");
+		if(out == NULL) {
+			fprintf(stderr, "Failed to write %s (%m)\n", path);
+			return 1;
+		}
+		if(type[1] == 'b') {
+			write_pbm(out, frame, header.width, header.height);
+		} else {
+			write_png(out, frame, header.width, header.height);
+		}
+		fclose(out);
+	}
+
+	if(info && count > 0) {
+		printf(
+			"%ux%u, %u frames (%u key) over %.1f s, %.1f bytes per frame\n",
+			header.width, header.height,
+			count, keys,
+			duration / 1e9,
+			total / (double)count
+		);
+	}
+
+	free(payload);
+	free(delta);
+	free(frame);
+	free(offsets);
+	fclose(f);
+	return 0;
+
+usage:
+	fprintf(stderr, "Usage: %s [-i] [-t pbm|png] [-o prefix] [-f first] [-n count] recording\n", argv[0]);
+	return 1;
+}
@@ -0,0 +1,13 @@
+#include "fmath.h"
+
+void fsinf_n(float *restrict out, const float *restrict x, size_t n) {
+	for(size_t i = 0; i < n; i++) {
+		out[i] = fsinf(x[i]);
+	}
+}
+
+void fcosf_n(float *restrict out, const float *restrict x, size_t n) {
+	for(size_t i = 0; i < n; i++) {
+		out[i] = fcosf(x[i]);
+	}
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <math.h>
+#include <stddef.h>
+
+// Fast stand-ins for the libm calls the frame makes. Building with
+// MATH=LIBM (FMATH_LIBM) turns them back into the libm calls.
+//
+// Error against libm, checked by the golden harness:
+//   fsinf, fcosf  Folded into a quarter turn, then a degree 9 polynomial.
+//                 Within 1e-6 for |x| <= 2pi. Rounding x / 2pi to a float
+//                 adds up to |x| * 1.2e-7 beyond that, about what rounding x
+//                 itself already costs.
+//   ffract        Exact, the same as modff for anything finite.
+//
+// The _n versions do a whole array and are written to vectorize.
+
+#ifdef FMATH_LIBM
+
+static inline float fsinf(float x) {
+	return sinf(x);
+}
+
+static inline float fcosf(float x) {
+	return cosf(x);
+}
+
+static inline float ffract(float x, float *integral) {
+	return modff(x, integral);
+}
+
+#else
+
+// sin(2 pi turns). Everything is a select, so loops over it vectorize.
+static inline float fsinturn(float turns) {
+	// Into [-1/2, 1/2] turn, then fold into [-1/4, 1/4] where the
+	// polynomial is fitted
+	float u = turns - rintf(turns);
+	float half = u < 0.0f ? -0.5f : 0.5f;
+	u = fabsf(u) > 0.25f ? half - u : u;
+	float u2 = u * u;
+	float p = 39.5368576f;
+	p = p * u2 - 76.5498047f;
+	p = p * u2 + 81.6010056f;
+	p = p * u2 - 41.3416557f;
+	p = p * u2 + 6.28318501f;
+	return p * u;
+}
+
+static inline float fsinf(float x) {
+	return fsinturn(x * (float)(0.5 / M_PI));
+}
+
+static inline float fcosf(float x) {
+	return fsinturn(x * (float)(0.5 / M_PI) + 0.25f);
+}
+
+static inline float ffract(float x, float *integral) {
+	*integral = truncf(x);
+	return x - *integral;
+}
+
+#endif
+
+void fsinf_n(float *restrict out, const float *restrict x, size_t n);
+void fcosf_n(float *restrict out, const float *restrict x, size_t n);
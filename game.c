@@ -0,0 +1,766 @@
+#include "game.h"
+#include "draw.h"
+#include "fmath.h"
+#include "sprite.h"
+#include "sim.h"
+#include "world.h"
+#include "entity.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <math.h>
+
+#ifdef ASSETS_PACK
+// Set from the asset pack before the first frame
+const struct Tex *noiseTex = NULL;
+const struct Tex *ditherTex = NULL;
+#else
+const struct Tex *noiseTex = &noiseTexture;
+const struct Tex *ditherTex = &ditherTexture;
+#endif
+
+// The fields of the player's batch of one, see sim.h
+struct dolphin {
+	float angle;
+	float dirx;
+	float diry;
+
+	int32_t x;
+	int32_t y;
+
+	float velx;
+	float vely;
+
+	uint8_t inWater;
+	float wiggleT;
+
+	float bend;
+	float wiggle;
+
+	uint8_t lastUp;
+	uint8_t splashed;
+	int32_t floor;
+} player;
+
+// @COMPLETE: It's possible for the player to splash multiple times, maybe we
+// should have multiple of these things
+struct splash {
+	// A random number to make the particles unique
+	uint8_t seed;
+
+	int32_t x;
+	uint8_t life;
+	uint8_t alive;
+
+	uint8_t scale;
+	uint8_t escale;
+} splash;
+
+static struct SimBatch one = {
+	.count = 1,
+	.angle = &player.angle,
+	.dirx = &player.dirx,
+	.diry = &player.diry,
+	.x = &player.x,
+	.y = &player.y,
+	.velx = &player.velx,
+	.vely = &player.vely,
+	.inWater = &player.inWater,
+	.lastUp = &player.lastUp,
+	.floor = &player.floor,
+	.bend = &player.bend,
+	.wiggleT = &player.wiggleT,
+	.wiggle = &player.wiggle,
+	.splashed = &player.splashed,
+	.splashX = &splash.x,
+	.splashScale = &splash.scale,
+	.splashEscale = &splash.escale,
+	.splashLife = &splash.life,
+};
+
+struct Mip noiseMip;
+
+static size_t level_size(const struct Tex *tex, uint8_t level) {
+	size_t width = tex->width >> level, height = tex->height >> level;
+	width = width ? width : 1;
+	height = height ? height : 1;
+	// Rounded up so the next level's header stays aligned
+	return (sizeof(struct Tex) + width * height + 3) & ~(size_t)3;
+}
+
+size_t mip_size(const struct Tex *tex) {
+	size_t size = 0;
+	for(uint8_t level = 1; level < MIP_LEVELS; level++) {
+		size += level_size(tex, level);
+	}
+	return size;
+}
+
+void mip_build(struct Mip *mip, const struct Tex *tex, void *memory) {
+	mip->level[0] = tex;
+	uint8_t *next = memory;
+	for(uint8_t level = 1; level < MIP_LEVELS; level++) {
+		const struct Tex *src = mip->level[level - 1];
+		struct Tex *dst = (struct Tex *)next;
+		dst->width = src->width > 1 ? src->width / 2 : 1;
+		dst->height = src->height > 1 ? src->height / 2 : 1;
+		// Average of the 2x2 block, wrapping around like samplei() does
+		for(uint32_t y = 0; y < dst->height; y++) {
+			for(uint32_t x = 0; x < dst->width; x++) {
+				uint32_t x0 = x * 2 % src->width, x1 = (x * 2 + 1) % src->width;
+				uint32_t y0 = y * 2 % src->height, y1 = (y * 2 + 1) % src->height;
+				uint32_t sum = src->data[y0 * src->width + x0] + src->data[y0 * src->width + x1]
+					+ src->data[y1 * src->width + x0] + src->data[y1 * src->width + x1];
+				dst->data[y * dst->width + x] = (sum + 2) / 4;
+			}
+		}
+		mip->level[level] = dst;
+		next += level_size(tex, level);
+	}
+}
+
+float sample(const struct Tex *tex, float x, float y) {
+	int16_t ix = x, iy = y;
+	float fx = x - ix, fy = y - iy;
+	float a = lerpf(samplei(tex, ix, iy       ), samplei(tex, ix + 1.0f, iy       ), fx);
+	float b = lerpf(samplei(tex, ix, iy + 1.0f), samplei(tex, ix + 1.0f, iy + 1.0f), fx);
+	return lerpf(a, b, fy);
+}
+
+float hash(float p) {
+	float f;
+	p = ffract(p * 0.011f, &f);
+	p *= p + 7.5f;
+	p *= p + p;
+	p = ffract(p, &f);
+	return p;
+}
+
+float noise(float x) {
+	float i;
+	float f = ffract(x, &i);
+	return slerpf(hash(i), hash(i + 1.0f), f);
+}
+
+bool genericKernels = false;
+
+// Canvas widths the kernels that go over whole rows are compiled for, with
+// the width as a constant. Any other width takes a generic version.
+#define COMMON_WIDTHS(X) X(400) X(800) X(1280)
+
+// World units the waves repeat over. They don't stretch with the canvas, a
+// wider one shows more of them.
+#define WAVE_PERIOD 400
+
+static inline __attribute__((always_inline)) void waveColumns(float *wave, const uint16_t width, int32_t w_offset, float t) {
+	// The four sines of every column go through fsinf_n as one long array
+	float arg[4][width], s[4][width];
+	for(uint16_t x = 0; x < width; x++) {
+		arg[0][x] = (w_offset + x + t*26) * M_PI*2 / WAVE_PERIOD  * 5.5f;
+		arg[1][x] = (w_offset + x - t*4) * M_PI*2 / WAVE_PERIOD  * 4.0f;
+		arg[2][x] = (w_offset + x + t*33) * M_PI*2 / WAVE_PERIOD * 7.3f;
+		arg[3][x] = (w_offset + x + -t*50) * M_PI*2 / WAVE_PERIOD * 1.2f;
+	}
+	fsinf_n(s[0], arg[0], 4 * width);
+	for(uint16_t x = 0; x < width; x++) {
+		wave[x] = s[0][x] * 2.0f;
+		wave[x] += s[1][x] * 2.0f;
+		wave[x] += s[2][x] * 1.2f;
+		wave[x] += s[3][x] * 4.0f;
+	}
+}
+
+void waveLine(float *wave, uint16_t width, int32_t w_offset, float t) {
+	switch(genericKernels ? 0 : width) {
+#define WAVE_KERNEL(w) case w: waveColumns(wave, w, w_offset, t); break;
+		COMMON_WIDTHS(WAVE_KERNEL)
+#undef WAVE_KERNEL
+		default:
+			if(width > 0) {
+				waveColumns(wave, width, w_offset, t);
+			}
+	}
+}
+
+enum Quality quality = Q_FULL;
+
+// Texels of the noise the cloud and foam layers step per screen pixel, the
+// larger of x and y. Both magnify the noise, so they read level 0, noiseTex
+// itself.
+#define CLOUD_TEXELS 0.5f
+#define FOAM_TEXELS 0.5f
+
+static inline float sampleNoise(float texels, int16_t x, int16_t y) {
+	uint8_t level = mip_level(texels);
+	// Only the ones that sample level 0 are built without the levels
+	assert(level == 0 || noiseMip.level[0] == noiseTex);
+	return level == 0 ? samplei(noiseTex, x, y) : samplem(&noiseMip, level, x, y);
+}
+
+// The clouds are the noise texture scrolling sideways, seen through a curve
+// that only depends on the altitude. The cutoff rises from ly -500 up to
+// -400, where the clouds end, and stays put beyond that either way. So the
+// curve is worked out once for every texel value at every altitude where
+// it's different, and a row of clouds is a texture row looked up through
+// its curve.
+#define CLOUD_CURVE_TOP (-500)
+#define CLOUD_CURVES 101
+static float cloudCurves[CLOUD_CURVES][256];
+
+static float cloudValue(uint8_t texel, int16_t ly) {
+	float cloud = texel/255.0f;
+	float cutoff = lerpf(1.0f, 0.55f, clampf(0.0f, 1.0f, (-ly-400)/100.0f));
+	return clampf(0.0f, 1.0f, ilerpf(0.0f, 1.0f-cutoff, cloud-cutoff)*2.1f);
+}
+
+// Before any tile is drawn, the workers only read them
+static void buildCloudCurves(void) {
+	static bool built = false;
+	if(built) {
+		return;
+	}
+	for(uint16_t i = 0; i < CLOUD_CURVES; i++) {
+		for(uint16_t texel = 0; texel < 256; texel++) {
+			cloudCurves[i][texel] = cloudValue(texel, CLOUD_CURVE_TOP + i);
+		}
+	}
+	built = true;
+}
+
+static inline const float *cloudCurve(int16_t ly) {
+	int16_t i = ly - CLOUD_CURVE_TOP;
+	return cloudCurves[i < 0 ? 0 : i >= CLOUD_CURVES ? CLOUD_CURVES - 1 : i];
+}
+
+// samplei() wraps every lookup with a division. Walking a row one pixel at
+// a time the column can be stepped instead: abs(lx) % width for lx + 1, from
+// the one for lx.
+static inline uint32_t nextCol(uint32_t col, int32_t lx, uint32_t width) {
+	if(lx < 0) {
+		return col == 0 ? width - 1 : col - 1;
+	}
+	return col + 1 == width ? 0 : col + 1;
+}
+
+static inline void dither(struct RenderContext *ctx, uint16_t sx, uint16_t sy, const uint8_t *row, uint32_t col, float color) {
+	plot(ctx, sx, sy, row[col]/255.0f <= color);
+}
+
+// The background is a stack of layers, but most rows only see a few of
+// them: under the surface there are no clouds, only the band just below the
+// surface has foam, and so on. shadeRow() is written for any combination and
+// is instantiated for every one of them with the combination as a constant,
+// so each gets its own loop with the other layers compiled out. What a row
+// needs is decided once per row.
+#define LAYER_FOAM 0x01
+#define LAYER_SEABED 0x02
+#define LAYER_CLOUD 0x04
+// Clouds copied from the row above instead of shaded
+#define LAYER_CLOUD_REUSE 0x08
+// The wave crosses the row, so air or water is decided per pixel. Without
+// this or LAYER_AIR the whole row is under water.
+#define LAYER_SURFACE 0x10
+#define LAYER_AIR 0x20
+// Shade the top left pixel of every 2x2 block, and dither the block from it
+// at full resolution
+#define LAYER_HALF 0x40
+
+static inline __attribute__((always_inline)) void shadeRow(struct RenderContext *ctx, const float *wave, const int16_t *seabed, const struct Rect *r, int32_t x, uint16_t sy, int16_t ly, float t, float *clouds, const unsigned layers) {
+	// The dither rows for this row and the one below, which the 2x2 blocks
+	// cover too, and the column under lx
+	const struct Tex *dt = ditherTex;
+	const uint8_t *ditherRow = dt->data + abs(ly) % dt->height * dt->width;
+	const uint8_t *ditherBelow = dt->data + abs((int16_t)(ly + 1)) % dt->height * dt->width;
+	int32_t left = x - ctx->width/2;
+	uint32_t ditherCol = abs((int16_t)(left + r->x0)) % dt->width;
+
+	// The texture row the clouds scroll along, and the column for the last
+	// texel looked up, which lasts a few pixels
+	const float *curve = NULL;
+	const uint8_t *cloudRow = NULL;
+	int16_t cloudX = 0;
+	uint32_t cloudCol = 0;
+	if(layers & LAYER_CLOUD) {
+		int16_t ty = ly/2.0f;
+		curve = cloudCurve(ly);
+		cloudRow = noiseTex->data + abs(ty) % noiseTex->height * noiseTex->width;
+		cloudX = (int16_t)((left + r->x0)/4.0f - t*10.0f) - 1;
+	}
+
+	for(uint16_t sx = r->x0; sx < r->x1; sx += layers & LAYER_HALF ? 2 : 1) {
+		int16_t lx = left + sx;
+		float color = 0.0f;
+
+		int16_t waveDist = wave[sx] - ly;
+
+		// Underwater
+		if(layers & LAYER_FOAM) {
+			float foamNoise = sampleNoise(FOAM_TEXELS, abs(lx/2), abs(ly/2));
+			float foam = lerpf(foamNoise*0.7f, 0.0f, clampf(0.0f, 1.0f, -waveDist/30.0f));
+			color += (layers & LAYER_SURFACE) && waveDist >= 0.0f ? 0.0f : foam;
+		}
+
+		// Seabed
+		if(layers & LAYER_SEABED) {
+			color += lerpf(0.0f, 1.0f, clampf(0.0f, 1.0f, (ly-seabed[sx])/10.0f));
+		}
+
+		// In Air
+		if(layers & LAYER_CLOUD) {
+			int16_t tx = (lx/4.0f)-t*10.0f;
+			if(tx != cloudX) {
+				cloudX = tx;
+				cloudCol = abs(tx) % noiseTex->width;
+			}
+			clouds[sx] = curve[cloudRow[cloudCol]];
+			color += clouds[sx];
+		} else if(layers & LAYER_CLOUD_REUSE) {
+			color += clouds[sx];
+		}
+
+		// Invert color in air
+		if(layers & LAYER_SURFACE) {
+			color = waveDist < 0.0f ? color : 1.0f - color;
+		} else if(layers & LAYER_AIR) {
+			color = 1.0f - color;
+		}
+
+		uint32_t col = ditherCol;
+		dither(ctx, sx, sy, ditherRow, col, color);
+		ditherCol = nextCol(col, lx, dt->width);
+		if(layers & LAYER_HALF) {
+			dither(ctx, sx + 1, sy, ditherRow, ditherCol, color);
+			dither(ctx, sx, sy + 1, ditherBelow, col, color);
+			dither(ctx, sx + 1, sy + 1, ditherBelow, ditherCol, color);
+			ditherCol = nextCol(ditherCol, lx + 1, dt->width);
+		}
+	}
+}
+
+#define WITH_POSITION(X, l) X(l) X((l) | LAYER_SURFACE) X((l) | LAYER_AIR)
+#define WITH_CLOUD(X, l) WITH_POSITION(X, l) WITH_POSITION(X, (l) | LAYER_CLOUD) WITH_POSITION(X, (l) | LAYER_CLOUD_REUSE)
+#define WITH_SEABED(X, l) WITH_CLOUD(X, l) WITH_CLOUD(X, (l) | LAYER_SEABED)
+#define WITH_FOAM(X, l) WITH_SEABED(X, l) WITH_SEABED(X, (l) | LAYER_FOAM)
+#define ROW_KERNELS(X) WITH_FOAM(X, 0) WITH_FOAM(X, LAYER_HALF)
+
+// The first row from the top that can't have clouds. Clouds only show where
+// the cutoff is below the brightest texel of the noise, so it depends on the
+// texture. A texel of 255 divides by zero at the cutoff of 1 and gives a
+// cloud anywhere, like the shader always did.
+static int16_t cloudTop(const struct Tex *tex) {
+	static const struct Tex *cached = NULL;
+	static int16_t top;
+	if(tex == cached) {
+		return top;
+	}
+
+	uint8_t brightest = 0;
+	for(size_t i = 0; i < tex->width * tex->height; i++) {
+		if(tex->data[i] > brightest) brightest = tex->data[i];
+	}
+	if(brightest == 255) {
+		top = INT16_MAX;
+	} else {
+		// Where lerpf(1.0, 0.55, (-ly-400)/100) drops to the texel, and a
+		// couple of rows to spare for rounding
+		top = floorf(-400.0f - 100.0f * (1.0f - brightest/255.0f) / 0.45f) + 2;
+	}
+	cached = tex;
+	return top;
+}
+
+struct Camera {
+	const float *wave;
+	const int16_t *seabed;
+	int32_t x;
+	int32_t y;
+	float t;
+	int16_t cloudTop;
+};
+
+// Only the part of the screen in r. Tiles have even sizes, so the 2x2
+// blocks of the half resolution level stay on the same pixels.
+static void shadeRect(struct RenderContext *ctx, const struct Camera *camera, const struct Rect *r) {
+	const float *wave = camera->wave;
+	const int16_t *seabed = camera->seabed;
+	int32_t x = camera->x, y = camera->y;
+	float t = camera->t;
+
+	// The wave only moves the layers within its range over these columns,
+	// with some room for the truncation to waveDist
+	float lowest = wave[r->x0], highest = wave[r->x0];
+	int16_t seabedTop = seabed[r->x0];
+	for(uint16_t sx = r->x0; sx < r->x1; sx++) {
+		if(wave[sx] < lowest) lowest = wave[sx];
+		if(wave[sx] > highest) highest = wave[sx];
+		if(seabed[sx] < seabedTop) seabedTop = seabed[sx];
+	}
+
+	float clouds[MAX_WIDTH];
+	bool half = quality >= Q_HALF_RES;
+	for(uint16_t sy = r->y0; sy < r->y1; sy += half ? 2 : 1) {
+		int16_t ly = (-y - ctx->height/2) + sy;
+		unsigned layers = half ? LAYER_HALF : 0;
+		if(ly < lowest - 1.0f) {
+			layers |= LAYER_AIR;
+		} else if(ly <= highest + 2.0f) {
+			layers |= LAYER_SURFACE | LAYER_FOAM;
+		} else if(ly <= highest + 31.0f) {
+			// Foam fades out 30 below the surface
+			layers |= LAYER_FOAM;
+		}
+		if(ly > seabedTop) {
+			layers |= LAYER_SEABED;
+		}
+		if(quality >= Q_CLOUD_ROWS && sy % 2 == 1) {
+			// Odd rows reuse the clouds of the row above
+			if(ly - 1 < camera->cloudTop) {
+				layers |= LAYER_CLOUD_REUSE;
+			}
+		} else if(ly < camera->cloudTop) {
+			layers |= LAYER_CLOUD;
+		}
+
+		switch(layers) {
+#define ROW_KERNEL(l) case l: shadeRow(ctx, wave, seabed, r, x, sy, ly, t, clouds, l); break;
+			ROW_KERNELS(ROW_KERNEL)
+#undef ROW_KERNEL
+			default:
+				assert(false);
+		}
+	}
+}
+
+void shadeBackground(struct RenderContext *ctx, const float *wave, const int16_t *seabed, int32_t x, int32_t y, float t) {
+	struct Rect screen = { 0, 0, ctx->width, ctx->height };
+	struct Camera camera = {
+		.wave = wave,
+		.seabed = seabed,
+		.x = x,
+		.y = y,
+		.t = t,
+		.cloudTop = cloudTop(noiseTex),
+	};
+	buildCloudCurves();
+	shadeRect(ctx, &camera, &screen);
+}
+
+static void backgroundTile(struct RenderContext *ctx, const struct Rect *tile, void *arg) {
+	shadeRect(ctx, arg, tile);
+}
+
+// Everything drawn over the background this frame
+static struct DrawList overlays;
+static char overlayText[DRAW_TEXT_MAX + 1];
+
+void game_overlay(const char *str) {
+	strncpy(overlayText, str, DRAW_TEXT_MAX);
+}
+
+// Seconds of game time
+static float t;
+// How much the dolphin has stirred the water up, from 0 to 1. It's what
+// sways the kelp, so the seabed goes still a few seconds after the dolphin
+// does.
+static float stir;
+#define STIR_SETTLE 0.02f
+
+uint32_t entityCount = ENTITY_DEFAULT;
+static struct Entities entities;
+
+// The next of a sequence of floats in [0, 1), its own so the splashes get
+// the same numbers out of rand() whatever the entities are
+static float nextRandom(uint32_t *state) {
+	*state = *state * 1664525u + 1013904223u;
+	return (*state >> 8) / 16777216.0f;
+}
+
+// Over 16 columns of sea each around the start. Fish come in schools of up
+// to 8 going the same way.
+#define SCHOOL_SIZE 8
+static void spawnEntities(unsigned seed) {
+	if(entities.start == NULL || entities.capacity != entityCount) {
+		entity_free(&entities);
+		if(!entity_alloc(&entities, entityCount)) {
+			entity_alloc(&entities, 0);
+		}
+	}
+	entities.count = 0;
+
+	uint32_t state = seed;
+	float spread = entityCount * 16.0f;
+	while(entities.count < entities.capacity) {
+		float x = (nextRandom(&state) - 0.5f) * spread, pick = nextRandom(&state);
+		float way = nextRandom(&state) < 0.5f ? -1.0f : 1.0f;
+		if(pick < 0.7f) {
+			float y = -40.0f - nextRandom(&state) * 360.0f, velx = way * (0.3f + nextRandom(&state) * 0.7f);
+			for(uint8_t i = 0; i < SCHOOL_SIZE; i++) {
+				float dx = (nextRandom(&state) - 0.5f) * 40.0f, dy = (nextRandom(&state) - 0.5f) * 30.0f;
+				entity_add(&entities, ENTITY_FISH, x + dx, y + dy, velx, 3.0f, nextRandom(&state) * M_PI*2);
+			}
+		} else if(pick < 0.9f) {
+			float y = 120.0f + nextRandom(&state) * 200.0f, velx = way * (1.0f + nextRandom(&state));
+			entity_add(&entities, ENTITY_BIRD, x, y, velx, 8.0f, nextRandom(&state) * M_PI*2);
+		} else {
+			entity_add(&entities, ENTITY_BUOY, x, 0.0f, 0.0f, 2.0f, nextRandom(&state) * M_PI*2);
+		}
+	}
+	entity_build(&entities);
+}
+
+// Every entity look is a sprite, like the dolphin. Lines are from the
+// entity's position, fish and birds have a couple of looks.
+#define LOOK_LINES 3
+struct Look {
+	uint8_t kind;
+	uint8_t v;
+	uint8_t count;
+	int8_t lines[LOOK_LINES][4];
+};
+
+static const struct Look looks[] = {
+	// Fish going right, and left
+	{ ENTITY_FISH, 1, 3, { { -3, -2, 4, 0 }, { -3, 2, 4, 0 }, { -5, -2, -5, 2 } } },
+	{ ENTITY_FISH, 1, 3, { { 3, -2, -4, 0 }, { 3, 2, -4, 0 }, { 5, -2, 5, 2 } } },
+	// A buoy's pole and float
+	{ ENTITY_BUOY, 0, 2, { { 0, 0, 0, -6 }, { -3, 0, 3, 0 } } },
+	// Birds flapping
+	{ ENTITY_BIRD, 0, 2, { { -5, -4, 0, 0 }, { 0, 0, 5, -4 } } },
+	{ ENTITY_BIRD, 0, 2, { { -5, -1, 0, 0 }, { 0, 0, 5, -1 } } },
+	{ ENTITY_BIRD, 0, 2, { { -5, 2, 0, 0 }, { 0, 0, 5, 2 } } },
+};
+#define LOOK_FISH 0
+#define LOOK_BUOY 2
+#define LOOK_BIRD 3
+#define BIRD_FLAPS 3
+
+static const struct Sprite *lookSprite(const struct Look *look) {
+	// Any anchor far enough from the edges does
+	const uint16_t a = 64;
+	struct SpriteKey key = { .fill = 1 };
+	for(uint8_t i = 0; i < look->count; i++) {
+		const int8_t *l = look->lines[i];
+		sprite_key_line(&key, a, a, a + l[0], a + l[1], a + l[2], a + l[3]);
+	}
+	return sprite_get(&key);
+}
+
+// Entities drawn at most, the rest of a crowded screen is left out
+#define ENTITY_DRAW_MAX 256
+// The dolphin's reach for bumping into things
+#define DOLPHIN_RADIUS 15.0f
+
+void game_reset(unsigned seed) {
+	memset(&splash, 0, sizeof(splash));
+	sim_reset(&one);
+	world_reset(seed);
+	// There are no chunks from a last frame yet, the first step's floor
+	// comes from making the one under the dolphin here
+	struct Chunk under;
+	world_generate(&under, seed, world_chunk_index(player.x));
+	player.floor = -under.seabed[player.x - under.index * CHUNK_WIDTH];
+	spawnEntities(seed);
+	t = 0.0f;
+	stir = 0.0f;
+	srand(seed);
+}
+
+// A strand of kelp from its root at (x, y) on the screen, swaying a little
+// more with every segment up. Segments off the screen are left out, like
+// splash particles.
+#define KELP_SEGMENT 8
+static void drawKelp(struct RenderContext *ctx, const struct Kelp *kelp, int32_t x, int32_t y) {
+	int32_t root = x;
+	for(uint8_t s = 1; s * KELP_SEGMENT <= kelp->length; s++) {
+		int32_t nx = root + fsinf(t * 1.5f + kelp->phase / 40.0f + s * 0.7f) * s * 1.5f * stir;
+		int32_t ny = y - KELP_SEGMENT;
+		if(x >= 0 && x < ctx->width && y >= 0 && y < ctx->height && nx >= 0 && nx < ctx->width && ny >= 0 && ny < ctx->height) {
+			draw_line(&overlays, x, y, nx, ny, 1, 1);
+		}
+		x = nx;
+		y = ny;
+	}
+}
+
+bool process(struct RenderContext *ctx) {
+	if(!pump(ctx)) {
+		return false;
+	}
+
+	if(ctx->keys[KC_ESC]) {
+		return false;
+	}
+
+	uint8_t input = 0;
+	if(ctx->keys[KC_LEFT]) input |= SIM_LEFT;
+	if(ctx->keys[KC_RIGHT]) input |= SIM_RIGHT;
+	if(ctx->keys[KC_UP]) input |= SIM_UP;
+	// The seabed under the dolphin, out of last frame's chunks, which it's
+	// still in the middle of. If its chunk wasn't ready the floor stays
+	// where it was, rather than dropping to the flat seabed for a frame.
+	if(world_chunk(world_chunk_index(player.x)) != NULL) {
+		player.floor = -world_seabed(player.x);
+	}
+	sim_step(&one, 0, 1, &input);
+	if(player.splashed) {
+		splash.seed = rand();
+		splash.alive = splash.life;
+	}
+
+	t += 0.01667f;
+	// Cut off at the end, the last bit of sway would go on for ever
+	stir = lerpf(stir, clampf(0.0f, 1.0f, sqrtf(player.velx * player.velx + player.vely * player.vely)), STIR_SETTLE);
+	if(stir < 0.01f) {
+		stir = 0.0f;
+	}
+
+	entity_step(&entities, t);
+	uint32_t bumped[16];
+	uint32_t bumps = entity_touching(&entities, player.x, player.y, DOLPHIN_RADIUS, bumped, 16);
+	for(uint32_t i = 0; i < bumps && i < 16; i++) {
+		entity_startle(&entities, bumped[i], player.x);
+	}
+
+	// The background is drawn last, tile by tile together with these
+	draw_reset(&overlays);
+
+	// The dolphin is always in the middle of the screen
+	int cx = ctx->width/2, cy = ctx->height/2;
+	int32_t left = player.x - cx;
+	world_frame(left, left + ctx->width, player.velx);
+
+	if(splash.alive > 0) {
+		int y_base = cy + player.y;
+		int x_base = splash.x - player.x + cx;
+
+		float prev_t = clampf(0.0f, 1.0f, 1.0f - (splash.alive+1.5f)/(float)splash.life);
+		float t = 1.0 - splash.alive/(float)splash.life;
+
+		uint8_t particles = splash.scale/4;
+		if(quality >= Q_SPLASH_CAP && particles > SPLASH_CAP) {
+			particles = SPLASH_CAP;
+		}
+		for(uint8_t i = 0; i < particles; i++) {
+			if(noise(0x40 ^ i ^ splash.seed) <= t) {
+				continue;
+			}
+			uint16_t x      = x_base +      t * (noise(i ^ splash.seed)-0.5f) * splash.scale * 1.0f;
+			uint16_t prev_x = x_base + prev_t * (noise(i ^ splash.seed)-0.5f) * splash.scale * 1.0f;
+
+			uint16_t y      = y_base - fsinf(     t * M_PI * lerpf(0.8f, 1.0f, noise(i ^ 0x80 ^ splash.seed))) * noise(i ^ 0x80 ^ splash.seed) * splash.scale * 0.25f;
+			uint16_t prev_y = y_base - fsinf(prev_t * M_PI * lerpf(0.8f, 1.0f, noise(i ^ 0x80 ^ splash.seed))) * noise(i ^ 0x80 ^ splash.seed) * splash.scale * 0.25f;
+			// We don't do clipping. Just discard any particle partly outside
+			// the viewport
+			if(x >= 0 && x < ctx->width && y >= 0 && y < ctx->height) {
+				if(prev_x >= 0 && prev_x < ctx->width && prev_y >= 0 && prev_y < ctx->height) {
+					draw_line(&overlays, x, y, prev_x, prev_y, 1, 0);
+				}
+			}
+		}
+
+		// This kinda looks bad
+		/* for(uint8_t i = 0; i < splash.escale/4; i++) { */
+		/* 	if(noise(0x40 | i) <= t) { */
+		/* 		continue; */
+		/* 	} */
+		/* 	uint16_t x      = x_base +      t * (noise(i)-0.5) * splash.escale * 0.25; */
+		/* 	uint16_t prev_x = x_base + prev_t * (noise(i)-0.5) * splash.escale * 0.25; */
+
+		/* 	uint16_t y      = y_base + sin(     t * M_PI * lerpf(0.8, 1.0, noise(i | 0x80))) * noise(i | 0x80) * splash.escale * 0.2625; */
+		/* 	uint16_t prev_y = y_base + sin(prev_t * M_PI * lerpf(0.8, 1.0, noise(i | 0x80))) * noise(i | 0x80) * splash.escale * 0.2625; */
+		/* 	if(x >= 0 && x < 400 && y >= 0 && y < 240) { */
+		/* 		plotLine(ctx, x, y, prev_x, prev_y, 1); */
+		/* 	} */
+		/* } */
+
+		splash.alive--;
+	}
+
+	for(int32_t index = world_chunk_index(left); index <= world_chunk_index(left + ctx->width - 1); index++) {
+		const struct Chunk *c = world_chunk(index);
+		for(uint8_t i = 0; c != NULL && i < c->kelps; i++) {
+			const struct Kelp *kelp = &c->kelp[i];
+			drawKelp(ctx, kelp, index * CHUNK_WIDTH + kelp->x - left, c->seabed[kelp->x] + player.y + cy);
+		}
+	}
+
+	{ // Entities whose position is on the screen
+		const struct Sprite *sprites[sizeof(looks) / sizeof(looks[0])];
+		for(size_t i = 0; i < sizeof(looks) / sizeof(looks[0]); i++) {
+			sprites[i] = lookSprite(&looks[i]);
+		}
+		uint32_t visible[ENTITY_DRAW_MAX];
+		int32_t top = player.y + cy;
+		uint32_t n = entity_query(&entities, left, top - ctx->height, left + ctx->width, top, visible, ENTITY_DRAW_MAX);
+		for(uint32_t k = 0; k < n && k < ENTITY_DRAW_MAX; k++) {
+			uint32_t i = visible[k];
+			int32_t sx = entities.x[i] - left, sy = top - entities.y[i];
+			if(sx < 0 || sx >= ctx->width || sy < 0 || sy >= ctx->height) {
+				continue;
+			}
+			uint8_t look = LOOK_BUOY;
+			if(entities.kind[i] == ENTITY_FISH) {
+				look = LOOK_FISH + (entities.velx[i] < 0.0f);
+			} else if(entities.kind[i] == ENTITY_BIRD) {
+				look = LOOK_BIRD + (uint32_t)(t * 8.0f + entities.phase[i]) % BIRD_FLAPS;
+			}
+			if(sprites[look] != NULL) {
+				draw_sprite(&overlays, sprites[look], sx, sy, looks[look].v);
+			}
+		}
+	}
+
+	float wiggle = lerpf(0.0, -fsinf(player.wiggle) * 0.4, player.wiggleT/60.0);
+	float tx = fcosf(player.angle - player.bend * 0.2 - wiggle), ty = fsinf(player.angle - player.bend * 0.2 - wiggle);
+	float hx = fcosf(player.angle + player.bend * 0.2), hy = fsinf(player.angle + player.bend * 0.2);
+	uint16_t body[4][4] = {
+		// Tail
+		{ cx - tx*25, cy - -ty*25, cx + ty* 5, cy +  tx* 5 },
+		{ cx - tx*25, cy - -ty*25, cx - ty* 5, cy -  tx* 5 },
+		// Head
+		{ cx + hy* 5, cy +  hx* 5, cx + hx*10, cy + -hy*10 },
+		{ cx - hy* 5, cy -  hx* 5, cx + hx*10, cy + -hy*10 },
+	};
+	// The same few poses come back all the time, so the dolphin is drawn
+	// from a cache of them
+	struct SpriteKey key = { .fill = 1 };
+	bool fits = true;
+	for(uint8_t i = 0; i < 4; i++) {
+		fits = fits && sprite_key_line(&key, cx, cy, body[i][0], body[i][1], body[i][2], body[i][3]);
+	}
+	const struct Sprite *sprite = fits ? sprite_get(&key) : NULL;
+	if(sprite != NULL) {
+		draw_sprite(&overlays, sprite, cx, cy, player.inWater);
+	} else {
+		for(uint8_t i = 0; i < 4; i++) {
+			draw_line(&overlays, body[i][0], body[i][1], body[i][2], body[i][3], 1, player.inWater);
+		}
+	}
+
+	/* plotLine(ctx, 200 - dx*10 - player.velx  , 120 - -dy*10 + player.vely  , 200 + dx*10 - player.velx  , 120 + -dy*10 + player.vely  , 2, 1); */
+	/* plotLine(ctx, 200 - dx*10 - player.velx*3, 120 - -dy*10 + player.vely*3, 200 + dx*10 - player.velx*3, 120 + -dy*10 + player.vely*3, 3, 1); */
+
+	draw_text(&overlays, 0, 0, overlayText);
+
+	{ // Draw the background and wave
+		float wave[MAX_WIDTH];
+		int16_t seabed[MAX_WIDTH];
+		waveLine(wave, ctx->width, player.x, t);
+		world_seabed_row(seabed, left, ctx->width);
+		struct Camera camera = {
+			.wave = wave,
+			.seabed = seabed,
+			.x = player.x,
+			.y = player.y,
+			.t = t,
+			.cloudTop = cloudTop(noiseTex),
+		};
+		buildCloudCurves();
+		draw_tiles(&overlays, ctx, backgroundTile, &camera);
+	}
+
+	return true;
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+#include "render.h"
+#include "draw.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <math.h>
+
+// The game itself. Every process() call advances the world one frame and
+// draws it into the canvas. The frame loop, and anything else that wants to
+// drive it (like the golden image harness), lives outside.
+
+// Fixed size fields, so a texture in an asset pack can be used in place
+// whatever the word size
+struct Tex {
+	uint32_t height;
+	uint32_t width;
+	uint8_t data[];
+};
+
+// Built in, see builtin.c
+extern const struct Tex noiseTexture;
+extern const struct Tex ditherTexture;
+extern char font8x8_basic[128][8];
+
+// What the shader samples. These point at the built in tables, or at copies
+// in the frame arena in real-time mode.
+extern const struct Tex *noiseTex;
+extern const struct Tex *ditherTex;
+
+static inline float clampf(float min, float max, float t) {
+	return fmaxf(fminf(t, max), min);
+}
+
+static inline float ilerpf(float a, float b, float t) {
+	return (t - a) / (b - a);
+}
+
+static inline float lerpf(float a, float b, float t) {
+	return a * (1.0f-t) + b * t;
+}
+
+static inline float slerpf(float min, float max, float v) {
+	return lerpf(min, max, v * v * (3.0f-2.0f*v));
+}
+
+static inline float samplei(const struct Tex *tex, int16_t x, int16_t y) {
+	uint16_t tx = abs(x)%tex->width, ty = abs(y)%tex->height;
+	return tex->data[(ty*tex->width) + tx]/255.0f;
+}
+
+// A texture and smaller copies of it, each half the size of the one before
+// and box filtered from it. Level 0 is the texture itself.
+#define MIP_LEVELS 4
+struct Mip {
+	const struct Tex *level[MIP_LEVELS];
+};
+
+// Bytes mip_build() needs for the levels after the first
+size_t mip_size(const struct Tex *tex);
+void mip_build(struct Mip *mip, const struct Tex *tex, void *memory);
+
+// The level for a lookup that steps this many texels of level 0 per screen
+// pixel: the smallest one that still has a texel for every pixel. Anything
+// magnified gets level 0.
+static inline uint8_t mip_level(float texels) {
+	uint8_t level = 0;
+	while(texels >= 2.0f && level < MIP_LEVELS - 1) {
+		texels /= 2.0f;
+		level++;
+	}
+	return level;
+}
+
+// samplei() with level 0 coordinates, on the given level
+static inline float samplem(const struct Mip *mip, uint8_t level, int16_t x, int16_t y) {
+	return samplei(mip->level[level], x >> level, y >> level);
+}
+
+// The levels of noiseTex, for layers that minify it. Whoever points
+// noiseTex somewhere else has to rebuild it. None of the game's layers do
+// yet, so only golden and microbench build it.
+extern struct Mip noiseMip;
+
+float sample(const struct Tex *tex, float x, float y);
+float hash(float p);
+float noise(float x);
+
+// Cheaper ways to draw a frame, for when we can't keep up. Every level
+// includes the ones before it.
+enum Quality {
+	Q_FULL,
+	// Clouds are only shaded on even rows, odd rows reuse the row above
+	Q_CLOUD_ROWS,
+	// The background is shaded once per 2x2 block, and dithered per pixel
+	Q_HALF_RES,
+	// Splashes throw at most SPLASH_CAP particles
+	Q_SPLASH_CAP,
+	Q_LAST,
+};
+#define SPLASH_CAP 16
+extern enum Quality quality;
+
+// The height of the sea surface in each of the width screen columns, for the
+// camera at world x offset
+void waveLine(float *wave, uint16_t width, int32_t offset, float t);
+// Sky, sea, foam, seabed and clouds for the camera at (x, y), dithered into
+// the canvas. wave and seabed, the depth of the seabed, have a column for
+// every column of it.
+void shadeBackground(struct RenderContext *ctx, const float *wave, const int16_t *seabed, int32_t x, int32_t y, float t);
+// The kernels that are compiled for the common canvas sizes take their
+// generic version for every size while this is set, to check them against
+// it
+extern bool genericKernels;
+
+// Fish, buoys and birds in the world, see entity.h. Takes effect at the next
+// game_reset().
+#define ENTITY_DEFAULT 256
+extern uint32_t entityCount;
+
+// Put the world back where it starts. The seed makes the seabed, see
+// world.h, and feeds the rng that varies the splashes.
+void game_reset(unsigned seed);
+bool process(struct RenderContext *ctx);
+// Text for the top left corner of the frames to come, like the frame rate
+void game_overlay(const char *str);
@@ -0,0 +1,682 @@
+#include "game.h"
+#include "asset.h"
+#include "convert.h"
+#include "fmath.h"
+#include "sim.h"
+#include "world.h"
+#include "entity.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Golden image harness. Drives the game without a display, with a fixed
+// input script and rng seed, and checks the frames it draws:
+//  - every variant of a kernel against the reference path, within the run
+//  - the reference path against frames stored by an earlier run (-w, -c)
+//
+// The usual flow for an optimization is `./golden -w ref` before the change
+// and `./golden -c ref` after, with -t when it's allowed to be approximate.
+// The stored frames are PBMs, so a failing frame can simply be looked at.
+// With -a the game is also run on the assets from a pack, which have to
+// draw the same as the built in ones. The fast math the frame is drawn with
+// is checked against libm up front, to the bounds fmath.h promises, and a
+// batch of dolphins stepped on threads against each one stepped alone, and
+// what the entity hash finds against looking at every entity.
+// Frames are stored at 400x240. The other canvas sizes the game is
+// compiled for are only checked within the run, against the generic
+// kernels.
+
+struct Press {
+	uint32_t from;
+	uint32_t to;
+	enum KeyCode key;
+};
+
+// Falls in, dives to the seabed, turns around and jumps high enough to see
+// the clouds, then falls back in. That's every layer of the shader, splashes
+// both ways and the dolphin in and out of the water.
+static const struct Press script[] = {
+	{  40,  70, KC_RIGHT },
+	{  75,  77, KC_UP },
+	{  85,  87, KC_UP },
+	{  95,  97, KC_UP },
+	{ 160, 225, KC_LEFT },
+	{ 230, 232, KC_UP },
+	{ 240, 242, KC_UP },
+	{ 250, 252, KC_UP },
+	{ 260, 262, KC_UP },
+	{ 270, 272, KC_UP },
+	{ 280, 282, KC_UP },
+	{ 380, 400, KC_RIGHT },
+	{ 520, 540, KC_LEFT },
+	{ 550, 552, KC_UP },
+};
+
+struct Variant {
+	const char *name;
+	// Pixels per frame allowed to differ from the reference, 0 for exact
+	uint32_t tolerance;
+	// Switch the variant on after the canvas is set up, and back off after
+	// the run. Either can be NULL.
+	void (*enable)(struct RenderContext *ctx);
+	void (*disable)(struct RenderContext *ctx);
+};
+
+static void padded_stride(struct RenderContext *ctx) {
+	// Like an SDL surface with a pitch wider than the visible row
+	free(ctx->buffer);
+	ctx->stride = WIDTH * 4 + 64;
+	ctx->buffer = calloc(HEIGHT, ctx->stride);
+}
+
+static void cloud_rows(struct RenderContext *ctx) {
+	quality = Q_CLOUD_ROWS;
+}
+
+static void half_res(struct RenderContext *ctx) {
+	quality = Q_HALF_RES;
+}
+
+static void splash_cap(struct RenderContext *ctx) {
+	quality = Q_SPLASH_CAP;
+}
+
+static void full_quality(struct RenderContext *ctx) {
+	quality = Q_FULL;
+}
+
+static void generic_kernels(struct RenderContext *ctx) {
+	genericKernels = true;
+}
+
+static void specialized_kernels(struct RenderContext *ctx) {
+	genericKernels = false;
+}
+
+static void world_thread(struct RenderContext *ctx) {
+	world_start();
+}
+
+static void world_no_thread(struct RenderContext *ctx) {
+	world_stop();
+}
+
+static void tile_threads(struct RenderContext *ctx) {
+	draw_start(3, NULL);
+}
+
+static void tile_threads_stop(struct RenderContext *ctx) {
+	draw_stop();
+}
+
+// The bands are put back together into a whole canvas, so the frame can be
+// checked like any other
+static uint8_t *unbanded;
+
+static void band_copy(struct RenderContext *ctx, uint16_t y0, uint16_t y1) {
+	memcpy(unbanded + y0 * WIDTH * 4, ctx->buffer, (y1 - y0) * WIDTH * 4);
+}
+
+// 10 rows, so some bands cross from one row of tiles to the next
+static void bands(struct RenderContext *ctx) {
+	free(ctx->buffer);
+	unbanded = calloc(HEIGHT, WIDTH * 4);
+	ctx->band_rows = 10;
+	ctx->band = band_copy;
+	ctx->stride = WIDTH * 4;
+	ctx->buffer = calloc(ctx->band_rows, ctx->stride);
+}
+
+static void bands_stop(struct RenderContext *ctx) {
+	free(ctx->buffer);
+	ctx->buffer = unbanded;
+	ctx->band_rows = 0;
+	ctx->band = NULL;
+	ctx->top = 0;
+}
+
+static void *mips;
+
+static void build_mips(void) {
+	free(mips);
+	mips = malloc(mip_size(noiseTex));
+	mip_build(&noiseMip, noiseTex, mips);
+}
+
+static void builtin_assets(struct RenderContext *ctx) {
+	noiseTex = &noiseTexture;
+	ditherTex = &ditherTexture;
+	font = font8x8_basic;
+	build_mips();
+}
+
+// Opened with -a
+static void pack_assets(struct RenderContext *ctx) {
+	size_t size;
+	noiseTex = asset_tex("noise");
+	ditherTex = asset_tex("dither");
+	font = asset_raw("font", &size);
+	build_mips();
+}
+
+static const struct Variant pack_variant = { "asset-pack", 0, pack_assets, builtin_assets };
+
+static const struct Variant variants[] = {
+	{ "padded-stride", 0, padded_stride, NULL },
+	{ "generic-kernels", 0, generic_kernels, specialized_kernels },
+	{ "world-thread", 0, world_thread, world_no_thread },
+	{ "tile-threads", 0, tile_threads, tile_threads_stop },
+	{ "bands", 0, bands, bands_stop },
+	// The governor's levels are meant to look a bit worse, just not broken.
+	// Up to 1% of the frame may differ.
+	{ "quality-cloud-rows", WIDTH * HEIGHT / 100, cloud_rows, full_quality },
+	{ "quality-half-res", WIDTH * HEIGHT / 100, half_res, full_quality },
+	{ "quality-splash-cap", WIDTH * HEIGHT / 100, splash_cap, full_quality },
+};
+
+static uint32_t frame;
+
+void init_render(struct RenderContext *ctx) {
+	memset(ctx->keys, 0, sizeof(ctx->keys));
+	ctx->width = WIDTH;
+	ctx->height = HEIGHT;
+	ctx->stride = WIDTH * 4;
+	ctx->buffer = calloc(HEIGHT, ctx->stride);
+	ctx->vsync = false;
+}
+
+bool pump(struct RenderContext *ctx) {
+	memset(ctx->keys, 0, sizeof(ctx->keys));
+	for(size_t i = 0; i < sizeof(script) / sizeof(script[0]); i++) {
+		if(frame >= script[i].from && frame < script[i].to) {
+			ctx->keys[script[i].key] = 1;
+		}
+	}
+	return true;
+}
+
+void render(struct RenderContext *ctx) {
+}
+
+void stop(struct RenderContext *ctx) {
+	free(ctx->buffer);
+}
+
+// Converters are ordered fastest first, so the plain C one is the last one
+// for the format
+static const struct Converter *reference_converter(enum PixelFormat format) {
+	const struct Converter *ref = NULL;
+	for(size_t i = 0; i < nconverters; i++) {
+		if(converters[i].format == format) {
+			ref = &converters[i];
+		}
+	}
+	return ref;
+}
+
+#define ROW_BYTES ((WIDTH + 7) / 8)
+#define FRAME_BYTES (ROW_BYTES * HEIGHT)
+
+static uint32_t frames = 720;
+static uint32_t every = 10;
+static unsigned seed = 1;
+
+// Check every other converter against the plain C one on this canvas,
+// counting the frames each one gets wrong
+static void check_converters(const struct RenderContext *ctx, uint32_t *failed) {
+	static uint8_t want[WIDTH * 4];
+	static uint8_t got[WIDTH * 4];
+	for(size_t i = 0; i < nconverters; i++) {
+		const struct Converter *c = &converters[i];
+		const struct Converter *ref = reference_converter(c->format);
+		if(c == ref) {
+			continue;
+		}
+		for(uint16_t y = 0; y < HEIGHT; y++) {
+			ref->row(want, ctx->buffer + y * ctx->stride, WIDTH);
+			c->row(got, ctx->buffer + y * ctx->stride, WIDTH);
+			if(memcmp(want, got, convert_row_bytes(c, WIDTH)) != 0) {
+				failed[i]++;
+				break;
+			}
+		}
+	}
+}
+
+// Play the script from the start and keep every checked frame as 1bpp,
+// black is 1 like in a PBM
+static void run(const struct Variant *v, uint8_t *out, uint32_t *converter_failed) {
+	const struct Converter *pack = reference_converter(PF_MONO01);
+	struct RenderContext ctx = {0};
+	init_render(&ctx);
+	if(v != NULL && v->enable != NULL) {
+		v->enable(&ctx);
+	}
+	game_reset(seed);
+
+	for(frame = 0; frame < frames; frame++) {
+		// The frame loop puts the frame rate here, which isn't repeatable
+		game_overlay("FPS 60");
+		process(&ctx);
+
+		if(frame % every != 0) {
+			continue;
+		}
+		uint8_t *packed = out + (frame / every) * FRAME_BYTES;
+		const uint8_t *canvas = ctx.band_rows != 0 ? unbanded : ctx.buffer;
+		uint32_t stride = ctx.band_rows != 0 ? WIDTH * 4 : ctx.stride;
+		for(uint16_t y = 0; y < HEIGHT; y++) {
+			pack->row(packed + y * ROW_BYTES, canvas + y * stride, WIDTH);
+		}
+		if(converter_failed != NULL) {
+			check_converters(&ctx, converter_failed);
+		}
+	}
+
+	if(v != NULL && v->disable != NULL) {
+		v->disable(&ctx);
+	}
+	stop(&ctx);
+}
+
+static uint32_t diff_pixels(const uint8_t *a, const uint8_t *b) {
+	uint32_t n = 0;
+	for(size_t i = 0; i < FRAME_BYTES; i++) {
+		n += __builtin_popcount(a[i] ^ b[i]);
+	}
+	return n;
+}
+
+// FNV-1a
+static uint64_t frame_hash(const uint8_t *packed) {
+	uint64_t h = 0xcbf29ce484222325ull;
+	for(size_t i = 0; i < FRAME_BYTES; i++) {
+		h = (h ^ packed[i]) * 0x100000001b3ull;
+	}
+	return h;
+}
+
+// Compare a whole run against the reference, printing the worst frame.
+// Returns false if any frame is off by more than tolerance pixels.
+static bool compare(const char *what, const char *name, const uint8_t *want, const uint8_t *got, uint32_t checked, uint32_t tolerance) {
+	uint32_t worst = 0, worst_frame = 0, over = 0;
+	for(uint32_t i = 0; i < checked; i++) {
+		uint32_t n = diff_pixels(want + i * FRAME_BYTES, got + i * FRAME_BYTES);
+		if(n > worst) {
+			worst = n;
+			worst_frame = i * every;
+		}
+		if(n > tolerance) over++;
+	}
+	if(over == 0) {
+		printf("%-9s %-20s ok (max %u px differ, %u allowed)\n", what, name, worst, tolerance);
+		return true;
+	}
+	printf("%-9s %-20s FAIL %u of %u frames, worst is frame %u with %u px\n", what, name, over, checked, worst_frame, worst);
+	return false;
+}
+
+// The first frames of the script on a width x height canvas, with the
+// kernels compiled for that size and then with the generic ones. That's
+// also every drawing call on a canvas of that size, which the asserts in
+// plot() check stay on it.
+static bool check_size(uint16_t width, uint16_t height, uint32_t frames) {
+	const struct Converter *pack = reference_converter(PF_MONO01);
+	size_t row_bytes = (width + 7) / 8, frame_bytes = row_bytes * height;
+	uint32_t checked = (frames + every - 1) / every;
+	uint8_t *packed[2] = { malloc(checked * frame_bytes), malloc(checked * frame_bytes) };
+
+	for(uint8_t generic = 0; generic < 2; generic++) {
+		struct RenderContext ctx = {
+			.width = width,
+			.height = height,
+			.stride = width * 4,
+			.buffer = calloc(height, width * 4),
+		};
+		genericKernels = generic;
+		game_reset(seed);
+		for(frame = 0; frame < frames; frame++) {
+			game_overlay("FPS 60");
+			process(&ctx);
+			if(frame % every == 0) {
+				for(uint16_t y = 0; y < height; y++) {
+					pack->row(packed[generic] + (frame / every) * frame_bytes + y * row_bytes, ctx.buffer + y * ctx.stride, width);
+				}
+			}
+		}
+		free(ctx.buffer);
+	}
+	genericKernels = false;
+
+	uint32_t differ = 0;
+	for(uint32_t i = 0; i < checked; i++) {
+		differ += memcmp(packed[0] + i * frame_bytes, packed[1] + i * frame_bytes, frame_bytes) != 0;
+	}
+	free(packed[1]);
+	free(packed[0]);
+
+	char what[32];
+	snprintf(what, sizeof(what), "%ux%u", width, height);
+	printf("%-9s %-20s %s (%u of %u frames differ from the generic kernels)\n", "size", what, differ == 0 ? "ok" : "FAIL", differ, checked);
+	return differ == 0;
+}
+
+// Worst error of fn against ref over [-range, range], to the bound fmath.h
+// gives for it. The array versions have to match the scalar ones exactly.
+static bool check_math(const char *name, float (*fn)(float), double (*ref)(double), void (*fn_n)(float *restrict, const float *restrict, size_t), float range) {
+	enum { N = 4096 };
+	static float x[N], y[N];
+	double worst = 0.0, worst_bound = 0.0;
+	float worst_x = 0.0f;
+	bool same = true;
+	for(uint32_t base = 0; base < 256; base++) {
+		for(uint32_t i = 0; i < N; i++) {
+			x[i] = -range + 2.0 * range * (base * N + i) / (256.0 * N - 1);
+		}
+		fn_n(y, x, N);
+		for(uint32_t i = 0; i < N; i++) {
+			float got = fn(x[i]);
+			same &= got == y[i];
+			double err = fabs(got - ref(x[i]));
+			double bound = fmax(1e-6, fabsf(x[i]) * 1.2e-7);
+			if(err / bound > worst / worst_bound || worst_bound == 0.0) {
+				worst = err;
+				worst_bound = bound;
+				worst_x = x[i];
+			}
+		}
+	}
+	bool ok = same && worst <= worst_bound;
+	char what[32];
+	snprintf(what, sizeof(what), "%s %g", name, range);
+	printf("%-9s %-20s %s (max error %.2g at %g, %.2g allowed)%s\n", "math", what, ok ? "ok" : "FAIL", worst, worst_x, worst_bound, same ? "" : ", array version differs");
+	return ok;
+}
+
+// Dolphins steering, kicking and coasting at random, a number that leaves
+// part of a block over, each over a seabed of its own depth. Stepped one at
+// a time they take the scalar path the player does, in a batch the
+// vectorized one.
+static bool check_sim(uint32_t steps) {
+	enum { N = 1000 };
+	static const uint8_t moves[] = { 0, SIM_LEFT, SIM_RIGHT, SIM_UP, SIM_LEFT | SIM_UP, SIM_RIGHT | SIM_UP };
+	uint8_t *inputs = malloc((size_t)N * steps);
+	uint32_t seed = 1;
+	for(uint32_t i = 0; i < N; i++) {
+		uint8_t move = 0;
+		for(uint32_t s = 0; s < steps; s++) {
+			seed = seed * 1103515245 + 12345;
+			if((seed >> 16) % 16 == 0) {
+				move = moves[(seed >> 20) % sizeof(moves)];
+			}
+			inputs[i * steps + s] = move;
+		}
+	}
+
+	struct SimBatch batch, one;
+	if(!sim_alloc(&batch, N) || !sim_alloc(&one, 1)) {
+		fprintf(stderr, "Failed to allocate dolphins\n");
+		exit(1);
+	}
+	for(uint32_t i = 0; i < N; i++) {
+		batch.floor[i] = -400 - i % 200;
+	}
+	sim_run(&batch, inputs, steps, steps, 4);
+
+	uint32_t differ = 0, splashes = 0, seabed = 0;
+	for(uint32_t i = 0; i < N; i++) {
+		sim_reset(&one);
+		*one.floor = batch.floor[i];
+		for(uint32_t s = 0; s < steps; s++) {
+			sim_step(&one, 0, 1, &inputs[i * steps + s]);
+			splashes += *one.splashed;
+			seabed += *one.y == *one.floor;
+		}
+		bool same = true;
+#define SAME(f) same &= memcmp(&batch.f[i], one.f, sizeof(*one.f)) == 0;
+		SAME(angle) SAME(dirx) SAME(diry) SAME(x) SAME(y) SAME(velx) SAME(vely)
+		SAME(inWater) SAME(lastUp) SAME(floor) SAME(bend) SAME(wiggleT) SAME(wiggle)
+		SAME(splashed) SAME(splashX) SAME(splashScale) SAME(splashEscale) SAME(splashLife)
+#undef SAME
+		differ += !same;
+	}
+	sim_free(&one);
+	sim_free(&batch);
+	free(inputs);
+
+	char what[32];
+	snprintf(what, sizeof(what), "%u dolphins", N);
+	printf("%-9s %-20s %s (%u differ, %u splashes, %u steps on the seabed)\n", "sim", what, differ == 0 ? "ok" : "FAIL", differ, splashes, seabed);
+	return differ == 0;
+}
+
+// [0, 1) from the same generator as check_sim()'s inputs
+static float next_random(uint32_t *seed) {
+	*seed = *seed * 1103515245 + 12345;
+	return (*seed >> 8 & 0xFFFF) / 65536.0f;
+}
+
+static int compare_u32(const void *a, const void *b) {
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+// Crowded entities stepping along, and rectangles from a few pixels to
+// bigger than the screen thrown at them. The hash has to find the same
+// ones as looking at every entity.
+static bool check_entities(uint32_t steps) {
+	enum { N = 5000, QUERIES = 20 };
+	struct Entities e;
+	if(!entity_alloc(&e, N)) {
+		fprintf(stderr, "Failed to allocate entities\n");
+		exit(1);
+	}
+	uint32_t seed = 1;
+	for(uint32_t i = 0; i < N; i++) {
+		float x = (next_random(&seed) - 0.5f) * 8000.0f;
+		float y = (next_random(&seed) - 0.6f) * 1000.0f;
+		float velx = (next_random(&seed) - 0.5f) * 4.0f;
+		float amp = next_random(&seed) * 8.0f;
+		entity_add(&e, i % ENTITY_KINDS, x, y, velx, amp, next_random(&seed) * 6.0f);
+	}
+	entity_build(&e);
+
+	static uint32_t got[N], want[N];
+	uint32_t differ = 0, found = 0;
+	for(uint32_t s = 0; s < steps; s++) {
+		entity_step(&e, s * 0.01667f);
+		for(uint32_t q = 0; q < QUERIES; q++) {
+			float x = (next_random(&seed) - 0.5f) * 8000.0f;
+			float y = (next_random(&seed) - 0.6f) * 1000.0f;
+			float w = next_random(&seed) * (q % 2 ? 30.0f : 1500.0f);
+			float h = next_random(&seed) * (q % 2 ? 30.0f : 800.0f);
+			uint32_t n = entity_query(&e, x, y, x + w, y + h, got, N);
+			uint32_t m = entity_query_all(&e, x, y, x + w, y + h, want, N);
+			qsort(got, n, sizeof(*got), compare_u32);
+			differ += n != m || memcmp(got, want, n * sizeof(*got)) != 0;
+			found += m;
+		}
+		// Something touching the dolphin now and then
+		uint32_t bumped[16];
+		uint32_t n = entity_touching(&e, e.x[s % N], e.y[s % N], 15.0f, bumped, 16);
+		for(uint32_t i = 0; i < n && i < 16; i++) {
+			entity_startle(&e, bumped[i], e.x[s % N]);
+		}
+	}
+	entity_free(&e);
+
+	char what[32];
+	snprintf(what, sizeof(what), "%u entities", N);
+	printf("%-9s %-20s %s (%u of %u queries differ, %u found)\n", "entities", what, differ == 0 ? "ok" : "FAIL", differ, steps * QUERIES, found);
+	return differ == 0;
+}
+
+static bool write_pbm(const char *dir, uint32_t number, const uint8_t *packed) {
+	char path[256];
+	snprintf(path, sizeof(path), "%s/%06u.pbm", dir, number);
+	FILE *f = fopen(path, "wb");
+	if(f == NULL) {
+		fprintf(stderr, "Failed to write %s (%m)\n", path);
+		return false;
+	}
+	fprintf(f, "P4\n%u %u\n", WIDTH, HEIGHT);
+	fwrite(packed, 1, FRAME_BYTES, f);
+	fclose(f);
+	return true;
+}
+
+static bool read_pbm(const char *dir, uint32_t number, uint8_t *packed) {
+	char path[256];
+	snprintf(path, sizeof(path), "%s/%06u.pbm", dir, number);
+	FILE *f = fopen(path, "rb");
+	if(f == NULL) {
+		fprintf(stderr, "Failed to read %s (%m)\n", path);
+		return false;
+	}
+	unsigned w, h;
+	bool ok = fscanf(f, "P4 %u %u", &w, &h) == 2 && w == WIDTH && h == HEIGHT
+		&& fgetc(f) != EOF
+		&& fread(packed, 1, FRAME_BYTES, f) == FRAME_BYTES;
+	if(!ok) {
+		fprintf(stderr, "%s is not a %ux%u PBM\n", path, WIDTH, HEIGHT);
+	}
+	fclose(f);
+	return ok;
+}
+
+int main(int argc, char *argv[]) {
+	const char *write_dir = NULL;
+	const char *check_dir = NULL;
+	uint32_t tolerance = 0;
+	const char *pack = NULL;
+	bool list = false;
+	for(int opt; (opt = getopt(argc, argv, "n:e:s:t:w:c:la:")) != -1;) {
+		switch(opt) {
+			case 'n':
+				frames = strtoul(optarg, NULL, 10);
+				break;
+			case 'e':
+				every = strtoul(optarg, NULL, 10);
+				break;
+			case 's':
+				seed = strtoul(optarg, NULL, 10);
+				break;
+			case 't':
+				tolerance = strtoul(optarg, NULL, 10);
+				break;
+			case 'w':
+				write_dir = optarg;
+				break;
+			case 'c':
+				check_dir = optarg;
+				break;
+			case 'l':
+				list = true;
+				break;
+			case 'a':
+				pack = optarg;
+				break;
+			default:
+				goto usage;
+		}
+	}
+	if(optind != argc || frames == 0 || every == 0) {
+		goto usage;
+	}
+
+	// The reference always uses the assets built into this binary
+	builtin_assets(NULL);
+	if(pack != NULL && !asset_open(pack)) {
+		return 1;
+	}
+
+	bool ok = true;
+	// Around zero, and out as far as the waves go
+	ok &= check_math("fsinf", fsinf, sin, fsinf_n, M_PI * 2);
+	ok &= check_math("fcosf", fcosf, cos, fcosf_n, M_PI * 2);
+	ok &= check_math("fsinf", fsinf, sin, fsinf_n, 4096.0f);
+	ok &= check_math("fcosf", fcosf, cos, fcosf_n, 4096.0f);
+	ok &= check_sim(frames);
+	ok &= check_entities(frames);
+
+	uint32_t checked = (frames + every - 1) / every;
+	uint8_t *want = malloc(checked * FRAME_BYTES);
+	uint8_t *got = malloc(checked * FRAME_BYTES);
+	uint32_t *converter_failed = calloc(nconverters, sizeof(uint32_t));
+
+	run(NULL, want, converter_failed);
+	uint64_t hash = 0xcbf29ce484222325ull;
+	for(uint32_t i = 0; i < checked; i++) {
+		uint64_t h = frame_hash(want + i * FRAME_BYTES);
+		if(list) {
+			printf("%06u %016llx\n", i * every, (unsigned long long)h);
+		}
+		hash = (hash ^ h) * 0x100000001b3ull;
+	}
+	printf("reference %u frames, %u checked, seed %u, hash %016llx\n", frames, checked, seed, (unsigned long long)hash);
+
+	for(size_t i = 0; i < nconverters; i++) {
+		const struct Converter *c = &converters[i];
+		if(c == reference_converter(c->format)) {
+			continue;
+		}
+		if(converter_failed[i] == 0) {
+			printf("%-9s %-20s ok (same as %s)\n", "converter", c->name, reference_converter(c->format)->name);
+		} else {
+			printf("%-9s %-20s FAIL on %u of %u frames\n", "converter", c->name, converter_failed[i], checked);
+			ok = false;
+		}
+	}
+
+	for(size_t i = 0; i < sizeof(variants) / sizeof(variants[0]); i++) {
+		run(&variants[i], got, NULL);
+		ok &= compare("variant", variants[i].name, want, got, checked, variants[i].tolerance);
+	}
+	if(pack != NULL) {
+		run(&pack_variant, got, NULL);
+		ok &= compare("variant", pack_variant.name, want, got, checked, pack_variant.tolerance);
+	}
+
+	// The common sizes above 400x240, and one that none of the kernels are
+	// compiled for. A quarter of the script still dives, splashes and
+	// jumps.
+	ok &= check_size(800, 480, frames / 4);
+	ok &= check_size(1280, 720, frames / 4);
+	ok &= check_size(640, 360, frames / 4);
+
+	if(write_dir != NULL) {
+		if(mkdir(write_dir, 0777) != 0 && errno != EEXIST) {
+			fprintf(stderr, "Failed to create %s (%m)\n", write_dir);
+			return 1;
+		}
+		for(uint32_t i = 0; i < checked; i++) {
+			if(!write_pbm(write_dir, i * every, want + i * FRAME_BYTES)) {
+				return 1;
+			}
+		}
+		printf("wrote %u frames to %s\n", checked, write_dir);
+	}
+
+	if(check_dir != NULL) {
+		for(uint32_t i = 0; i < checked; i++) {
+			if(!read_pbm(check_dir, i * every, got + i * FRAME_BYTES)) {
+				return 1;
+			}
+		}
+		ok &= compare("stored", check_dir, got, want, checked, tolerance);
+	}
+
+	free(mips);
+	free(converter_failed);
+	free(got);
+	free(want);
+	return ok ? 0 : 1;
+
+usage:
+	fprintf(stderr, "Usage: %s [-n frames] [-e every] [-s seed] [-l] [-a pack] [-w dir | -c dir [-t pixels]]\n", argv[0]);
+	return 1;
+}
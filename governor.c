@@ -0,0 +1,100 @@
+#include "governor.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// Frames we look back over when deciding to step down
+#define WINDOW 8
+// Frames in that window over budget before we step down
+#define OVER 3
+// Frames at under half the budget before we try a level up. Every try that
+// gets undone within TRIAL frames doubles the wait, one that holds resets it.
+#define CALM 120
+#define CALM_MAX (CALM << 4)
+#define TRIAL 60
+
+static struct {
+	uint64_t budget_ns;
+	bool pinned;
+	enum Quality level;
+
+	uint64_t recent[WINDOW];
+	uint32_t frame;
+	uint32_t calm;
+	uint32_t calm_needed;
+	// Frames left before the last step up counts as a success
+	uint32_t trial;
+
+	uint32_t changes;
+	uint32_t frames_at[Q_LAST];
+} gov;
+
+void governor_start(void) {
+	gov.budget_ns = 13000000;
+	gov.calm_needed = CALM;
+	if(getenv("FLIPPER_BUDGET_US") != NULL) {
+		gov.budget_ns = strtoull(getenv("FLIPPER_BUDGET_US"), NULL, 10) * 1000;
+	}
+	if(getenv("FLIPPER_QUALITY") != NULL) {
+		long level = strtol(getenv("FLIPPER_QUALITY"), NULL, 10);
+		gov.level = level < 0 ? Q_FULL : level >= Q_LAST ? Q_LAST - 1 : level;
+		gov.pinned = true;
+	}
+}
+
+enum Quality governor_frame(uint64_t draw_ns) {
+	gov.frames_at[gov.level]++;
+	if(gov.pinned) {
+		return gov.level;
+	}
+
+	gov.recent[gov.frame % WINDOW] = draw_ns;
+	gov.frame++;
+	if(gov.trial > 0 && --gov.trial == 0) {
+		gov.calm_needed = CALM;
+	}
+
+	uint32_t over = 0;
+	for(uint32_t i = 0; i < WINDOW; i++) {
+		if(gov.recent[i] > gov.budget_ns) over++;
+	}
+
+	if(over >= OVER && gov.level < Q_LAST - 1) {
+		// Stepping right back down means the last step up was too eager
+		if(gov.trial > 0 && gov.calm_needed < CALM_MAX) {
+			gov.calm_needed *= 2;
+		}
+		gov.trial = 0;
+		gov.level++;
+		gov.changes++;
+		gov.calm = 0;
+		// Judge the new level on its own frames
+		for(uint32_t i = 0; i < WINDOW; i++) {
+			gov.recent[i] = 0;
+		}
+		return gov.level;
+	}
+
+	gov.calm = draw_ns < gov.budget_ns / 2 ? gov.calm + 1 : 0;
+	if(gov.calm >= gov.calm_needed && gov.level > Q_FULL) {
+		gov.level--;
+		gov.changes++;
+		gov.calm = 0;
+		gov.trial = TRIAL;
+	}
+	return gov.level;
+}
+
+void governor_report(void) {
+	uint32_t total = 0;
+	for(int i = 0; i < Q_LAST; i++) {
+		total += gov.frames_at[i];
+	}
+	if(total == 0) {
+		return;
+	}
+	printf("Quality: %u changes%s, budget %.1f ms\n", gov.changes, gov.pinned ? " (pinned)" : "", gov.budget_ns / 1e6);
+	for(int i = 0; i < Q_LAST; i++) {
+		printf("  level %d %6.1f%% of frames\n", i, 100.0 * gov.frames_at[i] / total);
+	}
+}
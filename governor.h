@@ -0,0 +1,18 @@
+#pragma once
+
+#include "game.h"
+
+#include <stdint.h>
+
+// Picks the quality level from how long recent frames took to draw. It steps
+// down as soon as a few frames go over budget, and back up once there's been
+// plenty of headroom for a while.
+//
+// Configured through the environment:
+//   FLIPPER_BUDGET_US  Drawing time a frame may take, 13000 by default to
+//                      leave the rest of the 16.6 ms for presenting it
+//   FLIPPER_QUALITY    Pin the quality level (0 is full) and never change it
+void governor_start(void);
+// Feed it the time the frame took to draw, get the level for the next one
+enum Quality governor_frame(uint64_t draw_ns);
+void governor_report(void);
@@ -0,0 +1,140 @@
+#include "idle.h"
+#include "prof.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+// Frames in a row the same as the one on the screen before the loop slows
+// down, half a second of them. Every one after that doubles the period, up
+// to the longest.
+#define IDLE_AFTER 30
+
+static struct {
+	bool off;
+	uint32_t longest_us;
+	uint32_t period_us;
+
+	// Of the last frame presented
+	bool presented;
+	uint64_t hash;
+	uint32_t same;
+
+	// Where the clocks were at the last frame, and whether it was presented.
+	// The time until the next one is idle time if it wasn't.
+	uint64_t wall_at;
+	uint64_t cpu_at;
+	bool idle;
+
+	uint32_t frames;
+	uint32_t skipped;
+	uint32_t wakes;
+	uint64_t wall_ns[2];
+	uint64_t cpu_ns[2];
+} idle;
+
+// CPU time of every thread so far, tile workers and the prefetcher included
+static uint64_t cpu_now(void) {
+	struct rusage r;
+	getrusage(RUSAGE_SELF, &r);
+	return (r.ru_utime.tv_sec + r.ru_stime.tv_sec) * 1000000000ull + (r.ru_utime.tv_usec + r.ru_stime.tv_usec) * 1000ull;
+}
+
+void idle_start(void) {
+	idle.longest_us = 250000;
+	if(getenv("FLIPPER_IDLE_MS") != NULL) {
+		idle.longest_us = strtoul(getenv("FLIPPER_IDLE_MS"), NULL, 10) * 1000;
+		idle.off = idle.longest_us == 0;
+	}
+	idle.period_us = FRAME_US;
+	idle.wall_at = prof_now();
+	idle.cpu_at = cpu_now();
+}
+
+static inline uint64_t rotl(uint64_t v, uint8_t n) {
+	return v << n | v >> (64 - n);
+}
+
+// Four lanes that don't wait on each other's multiplies. The rotate carries
+// the high bits of a word down into the bits the next multiply spreads.
+#define HASH_K 0x9e3779b97f4a7c15ull
+static uint64_t canvas_hash(const struct RenderContext *ctx) {
+	uint64_t h[4] = { 1, 2, 3, 4 };
+	size_t row = ctx->width * 4;
+	for(uint16_t y = 0; y < ctx->height; y++) {
+		const uint8_t *p = ctx->buffer + y * ctx->stride;
+		size_t i = 0;
+		for(; i + 32 <= row; i += 32) {
+			for(uint8_t l = 0; l < 4; l++) {
+				uint64_t w;
+				memcpy(&w, p + i + l * 8, sizeof(w));
+				h[l] = rotl((h[l] ^ w) * HASH_K, 31);
+			}
+		}
+		for(; i < row; i++) {
+			h[0] = rotl((h[0] ^ p[i]) * HASH_K, 31);
+		}
+	}
+	return (h[0] ^ rotl(h[1], 16) ^ rotl(h[2], 32) ^ rotl(h[3], 48)) * HASH_K;
+}
+
+bool idle_frame(const struct RenderContext *ctx) {
+	uint64_t wall = prof_now(), cpu = cpu_now();
+	idle.wall_ns[idle.idle] += wall - idle.wall_at;
+	idle.cpu_ns[idle.idle] += cpu - idle.cpu_at;
+	idle.wall_at = wall;
+	idle.cpu_at = cpu;
+	idle.frames++;
+
+	idle.idle = false;
+	if(idle.off || ctx->band_rows != 0) {
+		return true;
+	}
+
+	// A frame that only collides with the last one is left out too, and the
+	// next one that changes anything puts it right
+	uint64_t hash = canvas_hash(ctx);
+	if(!idle.presented || hash != idle.hash) {
+		idle.presented = true;
+		idle.hash = hash;
+		idle.same = 0;
+		idle.period_us = FRAME_US;
+		return true;
+	}
+
+	idle.idle = true;
+	idle.skipped++;
+	if(++idle.same > IDLE_AFTER && idle.period_us < idle.longest_us) {
+		idle.period_us = idle.period_us * 2 < idle.longest_us ? idle.period_us * 2 : idle.longest_us;
+	}
+	return false;
+}
+
+uint32_t idle_period(void) {
+	return idle.period_us;
+}
+
+void idle_wake(void) {
+	idle.wakes++;
+	idle.same = 0;
+	idle.period_us = FRAME_US;
+}
+
+void idle_report(void) {
+	if(idle.frames == 0) {
+		return;
+	}
+	printf(
+		"Idle: %u of %u frames unchanged and not presented, %u woken by a key, sleeping up to %u ms%s\n",
+		idle.skipped, idle.frames, idle.wakes, idle.longest_us / 1000, idle.off ? " (off)" : ""
+	);
+	static const char *const names[2] = { "active", "idle" };
+	for(uint8_t i = 0; i < 2; i++) {
+		double minutes = idle.wall_ns[i] / 60e9;
+		printf(
+			"  %-6s %8.1f s, CPU %.2f s per minute\n",
+			names[i], idle.wall_ns[i] / 1e9, minutes > 0.0 ? idle.cpu_ns[i] / 1e9 / minutes : 0.0
+		);
+	}
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "render.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Leaves out frames that come out the same as the one on the screen, and
+// slows the frame loop down while they keep doing that. A still scene, like
+// the dolphin lying on the seabed with nothing swimming by, then costs a
+// frame every so often instead of 60 a second. The loop sleeps in
+// wait_input() between frames, so a key brings it back at once.
+//
+// Frames are told apart by a hash of the canvas. In band mode there's never
+// a whole frame to hash, every one is presented.
+//
+// Configured through the environment:
+//   FLIPPER_IDLE_MS  Longest the loop sleeps between frames while nothing
+//                    changes, 250 by default. 0 presents every frame.
+
+// From the start of one frame to the start of the next, when not idle
+#define FRAME_US 16600
+
+void idle_start(void);
+// Whether the frame just drawn into the canvas has to be presented. False
+// when it's the same as the last one that was.
+bool idle_frame(const struct RenderContext *ctx);
+// How long from the start of this frame to the start of the next
+uint32_t idle_period(void);
+// A key woke the loop, back to the full frame rate
+void idle_wake(void);
+// CPU time per minute while idle and while not
+void idle_report(void);
@@ -0,0 +1,503 @@
+#include "input.h"
+#include "rt.h"
+
+#include <assert.h>
+#include <libevdev/libevdev.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+
+#define MAX_DEVICES 16
+
+// epoll tags for the fds that aren't devices
+#define TAG_STOP    0xFFFFFFFF
+#define TAG_HOTPLUG 0xFFFFFFFE
+
+static const uint16_t keymap[KC_LAST] = {
+	[KC_LEFT] = KEY_D,
+	[KC_RIGHT] = KEY_K,
+	[KC_UP] = KEY_SPACE,
+	[KC_ESC] = KEY_ESC,
+};
+
+struct device {
+	struct libevdev *dev;
+	int fd;
+	char path[32];
+};
+
+struct latency {
+	uint32_t count;
+	uint64_t sum;
+	uint64_t min;
+	uint64_t max;
+};
+
+struct input {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t ready_cond;
+	pthread_cond_t changed_cond;
+
+	int epfd;
+	int stopfd;
+	int hotplugfd;
+
+	bool grab;
+	bool scan;
+	const char *replay;
+
+	struct device devices[MAX_DEVICES];
+
+	// Everything below is shared with the frame loop and guarded by lock
+	// Set once we have something to read keys from
+	bool ready;
+	uint8_t down[KC_LAST];
+	uint8_t latched[KC_LAST];
+	// Kernel timestamp of the last transition the frame loop hasn't seen yet
+	bool pending[KC_LAST];
+	struct timespec stamp[KC_LAST];
+
+	struct latency latency;
+};
+
+static uint64_t diff_us(const struct timespec *from, const struct timespec *to) {
+	int64_t us = (to->tv_sec - from->tv_sec) * 1000000 + (to->tv_nsec - from->tv_nsec) / 1000;
+	return us < 0 ? 0 : us;
+}
+
+static void apply(struct input *in, const struct input_event *ev) {
+	// Repeats don't change the state
+	if(ev->type != EV_KEY || ev->value == 2) {
+		return;
+	}
+
+	for(uint8_t k = 0; k < KC_LAST; k++) {
+		if(keymap[k] != ev->code) {
+			continue;
+		}
+
+		pthread_mutex_lock(&in->lock);
+		in->down[k] = ev->value;
+		in->latched[k] |= ev->value;
+		in->pending[k] = true;
+		in->stamp[k].tv_sec = ev->input_event_sec;
+		in->stamp[k].tv_nsec = ev->input_event_usec * 1000;
+		pthread_cond_broadcast(&in->changed_cond);
+		pthread_mutex_unlock(&in->lock);
+	}
+}
+
+static bool open_device(struct input *in, const char *path) {
+	int slot = -1;
+	for(int i = 0; i < MAX_DEVICES; i++) {
+		if(in->devices[i].dev == NULL) {
+			if(slot < 0) slot = i;
+		} else if(strcmp(in->devices[i].path, path) == 0) {
+			return true;
+		}
+	}
+	if(slot < 0) {
+		fprintf(stderr, "Too many input devices, ignoring %s\n", path);
+		return false;
+	}
+	struct device *d = &in->devices[slot];
+
+	// The node shows up before udev has fixed the permissions. We'll get
+	// another chance when the attributes change.
+	int fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+	if(fd < 0) {
+		return false;
+	}
+
+	struct libevdev *dev;
+	int rc = libevdev_new_from_fd(fd, &dev);
+	if(rc < 0) {
+		fprintf(stderr, "Failed to init libevdev for %s (%s)\n", path, strerror(-rc));
+		close(fd);
+		return false;
+	}
+
+	// We only care about things that can press the keys we use
+	bool keyboard = libevdev_has_event_type(dev, EV_KEY);
+	for(uint8_t k = 0; k < KC_LAST; k++) {
+		keyboard = keyboard && libevdev_has_event_code(dev, EV_KEY, keymap[k]);
+	}
+	if(!keyboard) {
+		libevdev_free(dev);
+		close(fd);
+		return false;
+	}
+
+	// Get the timestamps on the same clock as the frame loop so we can
+	// subtract them
+	libevdev_set_clock_id(dev, CLOCK_MONOTONIC);
+
+	if(in->grab && libevdev_grab(dev, LIBEVDEV_GRAB) < 0) {
+		fprintf(stderr, "Failed to grab %s\n", path);
+	}
+
+	struct epoll_event ev = {
+		.events = EPOLLIN,
+		.data.u32 = slot,
+	};
+	if(epoll_ctl(in->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+		perror("epoll_ctl");
+		libevdev_free(dev);
+		close(fd);
+		return false;
+	}
+
+	d->dev = dev;
+	d->fd = fd;
+	snprintf(d->path, sizeof(d->path), "%s", path);
+
+	pthread_mutex_lock(&in->lock);
+	in->ready = true;
+	pthread_cond_broadcast(&in->ready_cond);
+	pthread_mutex_unlock(&in->lock);
+
+	printf("Input device name: \"%s\" (%s)\n", libevdev_get_name(dev), path);
+	printf(
+		"Input device ID: bus %#x vendor %#x product %#x\n",
+		libevdev_get_id_bustype(dev),
+		libevdev_get_id_vendor(dev),
+		libevdev_get_id_product(dev)
+	);
+	return true;
+}
+
+static void close_device(struct input *in, struct device *d) {
+	printf("Input device removed (%s)\n", d->path);
+	epoll_ctl(in->epfd, EPOLL_CTL_DEL, d->fd, NULL);
+	libevdev_free(d->dev);
+	close(d->fd);
+	d->dev = NULL;
+	d->fd = -1;
+}
+
+static void discover(struct input *in) {
+	DIR *dir = opendir("/dev/input");
+	if(dir == NULL) {
+		perror("opendir /dev/input");
+		return;
+	}
+
+	for(struct dirent *e; (e = readdir(dir)) != NULL;) {
+		if(strncmp(e->d_name, "event", 5) != 0) {
+			continue;
+		}
+		char path[32];
+		snprintf(path, sizeof(path), "/dev/input/%s", e->d_name);
+		open_device(in, path);
+	}
+	closedir(dir);
+}
+
+static void hotplug(struct input *in) {
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	ssize_t len;
+	while((len = read(in->hotplugfd, buf, sizeof(buf))) > 0) {
+		for(char *p = buf; p < buf + len;) {
+			struct inotify_event *e = (struct inotify_event *)p;
+			if(e->len > 0 && strncmp(e->name, "event", 5) == 0) {
+				char path[32];
+				snprintf(path, sizeof(path), "/dev/input/%s", e->name);
+				open_device(in, path);
+			}
+			p += sizeof(struct inotify_event) + e->len;
+		}
+	}
+}
+
+static void drain(struct input *in, struct device *d) {
+	struct input_event ev;
+	int rc;
+	for(;;) {
+		rc = libevdev_next_event(d->dev, LIBEVDEV_READ_FLAG_NORMAL, &ev);
+		if(rc == LIBEVDEV_READ_STATUS_SUCCESS) {
+			apply(in, &ev);
+		} else if(rc == LIBEVDEV_READ_STATUS_SYNC) {
+			// The kernel buffer overflowed. libevdev hands us the delta to
+			// the real device state, read that and then continue as normal
+			apply(in, &ev);
+			do {
+				rc = libevdev_next_event(d->dev, LIBEVDEV_READ_FLAG_SYNC, &ev);
+				if(rc == LIBEVDEV_READ_STATUS_SYNC) {
+					apply(in, &ev);
+				}
+			} while(rc == LIBEVDEV_READ_STATUS_SYNC);
+		} else {
+			break;
+		}
+	}
+
+	if(rc != -EAGAIN) {
+		close_device(in, d);
+	}
+}
+
+// Wait for the stop signal for at most timeout ms. Returns true when we
+// should stop.
+static bool wait_stop(struct input *in, int timeout) {
+	struct epoll_event ev;
+	int n = epoll_wait(in->epfd, &ev, 1, timeout);
+	return n > 0 && ev.data.u32 == TAG_STOP;
+}
+
+static void replay(struct input *in) {
+	FILE *f = fopen(in->replay, "rb");
+	if(f == NULL) {
+		fprintf(stderr, "Failed to open replay %s (%m)\n", in->replay);
+		return;
+	}
+
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	struct input_event ev;
+	struct timespec first = {0};
+	bool have_first = false;
+	while(fread(&ev, sizeof(ev), 1, f) == 1) {
+		struct timespec at = {
+			.tv_sec = ev.input_event_sec,
+			.tv_nsec = ev.input_event_usec * 1000,
+		};
+		if(!have_first) {
+			first = at;
+			have_first = true;
+		}
+
+		// Play it back with the original spacing
+		uint64_t offset = diff_us(&first, &at);
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		uint64_t elapsed = diff_us(&start, &now);
+		if(offset > elapsed && wait_stop(in, (offset - elapsed) / 1000)) {
+			break;
+		}
+
+		// Pretend the kernel just delivered it
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		ev.input_event_sec = now.tv_sec;
+		ev.input_event_usec = now.tv_nsec / 1000;
+		apply(in, &ev);
+	}
+	fclose(f);
+}
+
+static void *input_thread(void *arg) {
+	struct input *in = arg;
+	rt_thread(RT_INPUT);
+
+	if(in->replay != NULL) {
+		replay(in);
+		while(!wait_stop(in, -1));
+		return NULL;
+	}
+
+	// Scanning the devices is slow enough that we do it here, while the
+	// frame loop is busy setting up the display
+	if(in->scan) {
+		discover(in);
+	}
+
+	for(;;) {
+		struct epoll_event events[MAX_DEVICES + 2];
+		int n = epoll_wait(in->epfd, events, MAX_DEVICES + 2, -1);
+		if(n < 0) {
+			if(errno == EINTR) continue;
+			perror("epoll_wait");
+			return NULL;
+		}
+
+		for(int i = 0; i < n; i++) {
+			uint32_t tag = events[i].data.u32;
+			if(tag == TAG_STOP) {
+				return NULL;
+			} else if(tag == TAG_HOTPLUG) {
+				hotplug(in);
+			} else if(in->devices[tag].dev != NULL) {
+				drain(in, &in->devices[tag]);
+			}
+		}
+	}
+}
+
+struct input *input_start(void) {
+	struct input *in = calloc(1, sizeof(struct input));
+	assert(in != NULL);
+	pthread_mutex_init(&in->lock, NULL);
+	{
+		pthread_condattr_t attr;
+		pthread_condattr_init(&attr);
+		pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+		pthread_cond_init(&in->ready_cond, &attr);
+		pthread_cond_init(&in->changed_cond, &attr);
+		pthread_condattr_destroy(&attr);
+	}
+	for(int i = 0; i < MAX_DEVICES; i++) {
+		in->devices[i].fd = -1;
+	}
+	in->hotplugfd = -1;
+
+	in->grab = getenv("FLIPPER_GRAB") != NULL;
+	in->replay = getenv("FLIPPER_REPLAY");
+	const char *only = getenv("FLIPPER_INPUT");
+
+	in->epfd = epoll_create1(EPOLL_CLOEXEC);
+	in->stopfd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if(in->epfd < 0 || in->stopfd < 0) {
+		perror("Failed to setup input");
+		abort();
+	}
+
+	struct epoll_event ev = {
+		.events = EPOLLIN,
+		.data.u32 = TAG_STOP,
+	};
+	epoll_ctl(in->epfd, EPOLL_CTL_ADD, in->stopfd, &ev);
+
+	if(in->replay != NULL) {
+		printf("Replaying input from %s\n", in->replay);
+		in->ready = true;
+	} else if(only != NULL) {
+		if(!open_device(in, only)) {
+			fprintf(stderr, "%s is not a usable keyboard\n", only);
+			exit(1);
+		}
+	} else {
+		// Start watching before the scan, so we can't miss a device that
+		// shows up in between
+		in->hotplugfd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if(in->hotplugfd < 0 || inotify_add_watch(in->hotplugfd, "/dev/input", IN_CREATE | IN_ATTRIB) < 0) {
+			perror("Failed to watch /dev/input, hotplug disabled");
+		} else {
+			ev.data.u32 = TAG_HOTPLUG;
+			epoll_ctl(in->epfd, EPOLL_CTL_ADD, in->hotplugfd, &ev);
+		}
+		in->scan = true;
+	}
+
+	if(pthread_create(&in->thread, NULL, input_thread, in) != 0) {
+		perror("Failed to start input thread");
+		abort();
+	}
+
+	return in;
+}
+
+// CLOCK_MONOTONIC timeout_us from now, for the condition variables
+static struct timespec deadline_after(uint64_t timeout_us) {
+	struct timespec deadline;
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += timeout_us / 1000000;
+	deadline.tv_nsec += (timeout_us % 1000000) * 1000;
+	if(deadline.tv_nsec >= 1000000000) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000;
+	}
+	return deadline;
+}
+
+bool input_wait(struct input *in, uint32_t timeout_ms) {
+	struct timespec deadline = deadline_after(timeout_ms * 1000ull);
+
+	pthread_mutex_lock(&in->lock);
+	int rc = 0;
+	while(!in->ready && rc != ETIMEDOUT) {
+		rc = pthread_cond_timedwait(&in->ready_cond, &in->lock, &deadline);
+	}
+	bool ready = in->ready;
+	pthread_mutex_unlock(&in->lock);
+	return ready;
+}
+
+static bool any_pending(const struct input *in) {
+	for(uint8_t k = 0; k < KC_LAST; k++) {
+		if(in->pending[k]) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool input_sleep(struct input *in, uint32_t timeout_us) {
+	struct timespec deadline = deadline_after(timeout_us);
+
+	pthread_mutex_lock(&in->lock);
+	int rc = 0;
+	while(!any_pending(in) && rc != ETIMEDOUT) {
+		rc = pthread_cond_timedwait(&in->changed_cond, &in->lock, &deadline);
+	}
+	bool woken = any_pending(in);
+	pthread_mutex_unlock(&in->lock);
+	return woken;
+}
+
+void input_poll(struct input *in, uint8_t keys[KC_LAST]) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	pthread_mutex_lock(&in->lock);
+	for(uint8_t k = 0; k < KC_LAST; k++) {
+		keys[k] = in->down[k] | in->latched[k];
+		in->latched[k] = 0;
+
+		if(in->pending[k]) {
+			in->pending[k] = false;
+
+			uint64_t us = diff_us(&in->stamp[k], &now);
+			struct latency *l = &in->latency;
+			if(l->count == 0 || us < l->min) l->min = us;
+			if(us > l->max) l->max = us;
+			l->sum += us;
+			l->count++;
+		}
+	}
+	pthread_mutex_unlock(&in->lock);
+}
+
+void input_stop(struct input *in) {
+	uint64_t one = 1;
+	if(write(in->stopfd, &one, sizeof(one)) != sizeof(one)) {
+		perror("Failed to stop input thread");
+	}
+	pthread_join(in->thread, NULL);
+
+	for(int i = 0; i < MAX_DEVICES; i++) {
+		if(in->devices[i].dev != NULL) {
+			if(in->grab) libevdev_grab(in->devices[i].dev, LIBEVDEV_UNGRAB);
+			libevdev_free(in->devices[i].dev);
+			close(in->devices[i].fd);
+		}
+	}
+
+	const struct latency *l = &in->latency;
+	if(l->count > 0) {
+		printf(
+			"Key to physics latency: %u events, min %llu us, avg %llu us, max %llu us\n",
+			l->count,
+			(unsigned long long)l->min,
+			(unsigned long long)(l->sum / l->count),
+			(unsigned long long)l->max
+		);
+	}
+
+	if(in->hotplugfd >= 0) close(in->hotplugfd);
+	close(in->stopfd);
+	close(in->epfd);
+	pthread_cond_destroy(&in->ready_cond);
+	pthread_cond_destroy(&in->changed_cond);
+	pthread_mutex_destroy(&in->lock);
+	free(in);
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "render.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Event driven evdev input. A dedicated thread waits on every keyboard it can
+// find (and any that get plugged in later) with epoll, and folds the events
+// into a key state that pump() samples once per frame.
+//
+// Configured through the environment:
+//   FLIPPER_INPUT   Only use this event device instead of discovering them
+//   FLIPPER_GRAB    Grab the devices so keystrokes don't leak to the console
+//   FLIPPER_REPLAY  Read raw input_event records from this file instead of
+//                   devices (e.g. a capture made with `cat /dev/input/eventN`)
+struct input;
+
+struct input *input_start(void);
+// Block until there's at least one keyboard, or the timeout runs out.
+// Returns false on timeout.
+bool input_wait(struct input *in, uint32_t timeout_ms);
+// Block until a key goes down or up that input_poll() hasn't reported yet,
+// or the timeout runs out. Returns false on timeout.
+bool input_sleep(struct input *in, uint32_t timeout_us);
+// Copy the current key state into keys. A key that was pressed and released
+// since the last poll is reported as held for this one poll.
+void input_poll(struct input *in, uint8_t keys[KC_LAST]);
+void input_stop(struct input *in);
@@ -0,0 +1,135 @@
+#include "mem.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define HUGE_PAGE (2 << 20)
+
+static uint8_t *arena = NULL;
+static size_t arena_len = 0;
+static size_t arena_used = 0;
+
+void prefault(const void *addr, size_t len, bool writable) {
+	size_t page = sysconf(_SC_PAGESIZE);
+	uintptr_t start = (uintptr_t)addr & ~(page - 1);
+	uintptr_t end = (uintptr_t)addr + len;
+
+	// mlock populates the range itself, including breaking COW on
+	// writable private mappings
+	if(mlock((void *)start, end - start) == 0) {
+		return;
+	}
+
+	madvise((void *)start, end - start, MADV_WILLNEED);
+	for(uintptr_t p = start; p < end; p += page) {
+		volatile uint8_t *b = (volatile uint8_t *)(p < (uintptr_t)addr ? (uintptr_t)addr : p);
+		if(writable) {
+			*b = *b;
+		} else {
+			(void)*b;
+		}
+	}
+}
+
+bool mem_huge(size_t len) {
+	assert(arena == NULL);
+	len = (len + HUGE_PAGE - 1) & ~(size_t)(HUGE_PAGE - 1);
+
+	void *p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if(p != MAP_FAILED) {
+		arena = p;
+		arena_len = len;
+		return true;
+	}
+
+	// No reserved huge pages, ask for transparent ones instead. Those only
+	// work on aligned ranges, so over allocate and trim.
+	p = mmap(NULL, len + HUGE_PAGE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(p == MAP_FAILED) {
+		perror("Failed to map frame arena");
+		return false;
+	}
+	uintptr_t base = ((uintptr_t)p + HUGE_PAGE - 1) & ~(uintptr_t)(HUGE_PAGE - 1);
+	if(base != (uintptr_t)p) {
+		munmap(p, base - (uintptr_t)p);
+	}
+	munmap((void *)(base + len), (uintptr_t)p + HUGE_PAGE - base);
+	madvise((void *)base, len, MADV_HUGEPAGE);
+
+	arena = (uint8_t *)base;
+	arena_len = len;
+	return false;
+}
+
+void *mem_alloc(size_t len) {
+	// Keep everything cache line aligned
+	len = (len + 63) & ~(size_t)63;
+	if(arena != NULL && arena_len - arena_used >= len) {
+		void *p = arena + arena_used;
+		arena_used += len;
+		return p;
+	}
+	return malloc(len);
+}
+
+void mem_free(void *p) {
+	// The arena lives as long as the process
+	if(arena != NULL && (uint8_t *)p >= arena && (uint8_t *)p < arena + arena_len) {
+		return;
+	}
+	free(p);
+}
+
+#if defined(MEM_ALLOC_CHECK) && defined(__GLIBC__)
+// Interpose the allocator. Only the thread running the frame loop is
+// counted, the input thread is free to allocate when devices come and go.
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static __thread bool in_frame = false;
+static __thread uint32_t frame_allocs = 0;
+
+void *malloc(size_t size) {
+	if(in_frame) frame_allocs++;
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+	if(in_frame) frame_allocs++;
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+	if(in_frame) frame_allocs++;
+	return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr) {
+	__libc_free(ptr);
+}
+#endif
+
+#ifdef MEM_ALLOC_CHECK
+void mem_frame_begin(void) {
+#ifdef __GLIBC__
+	frame_allocs = 0;
+	in_frame = true;
+#endif
+}
+
+void mem_frame_end(void) {
+#ifdef __GLIBC__
+	in_frame = false;
+	if(frame_allocs != 0) {
+		fprintf(stderr, "Frame loop made %u heap allocations\n", frame_allocs);
+		abort();
+	}
+#endif
+}
+#endif
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Fault in a range up front and lock it in memory if we're allowed to, so
+// the first frames don't pay for it. Only writable ranges get write faults,
+// so const data can be passed in too.
+void prefault(const void *addr, size_t len, bool writable);
+
+// Long lived buffers that the frame loop touches every frame (canvas,
+// textures). Once mem_huge() has set up an arena they're carved out of huge
+// pages, otherwise they come from malloc. Returns true if the arena is
+// backed by reserved huge pages rather than transparent ones.
+bool mem_huge(size_t len);
+void *mem_alloc(size_t len);
+void mem_free(void *p);
+
+// Builds with ALLOC_CHECK=1 count heap allocations made by the frame loop
+// thread between these two calls and abort if there were any. It's off by
+// default, since a backend's own libraries can allocate in there (SDL does
+// while it polls events).
+#ifdef MEM_ALLOC_CHECK
+void mem_frame_begin(void);
+void mem_frame_end(void);
+#else
+#define mem_frame_begin()
+#define mem_frame_end()
+#endif
@@ -0,0 +1,401 @@
+#include "bench.h"
+#include "game.h"
+#include "prof.h"
+#include "sprite.h"
+#include "world.h"
+#include "fmath.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Times the hot helpers of the game one at a time, each over inputs shaped
+// like what a real frame feeds it. -c prints CSV instead of the table, so
+// runs from different boards and builds can be put side by side.
+
+#if defined(__aarch64__)
+#define ARCH "aarch64"
+#elif defined(__arm__)
+#define ARCH "arm"
+#elif defined(__x86_64__)
+#define ARCH "x86_64"
+#else
+#define ARCH "unknown"
+#endif
+
+#define OPS 4096
+#define LINES 256
+// Dolphin poses, a turn of the angle in small steps
+#define POSES 64
+
+static struct {
+	// samplei as the foam layer calls it, over the frames of a dive
+	int16_t ix[OPS], iy[OPS];
+	// Anywhere in the texture, with a fractional part
+	float fx[OPS], fy[OPS];
+	// Splash particle numbers xor the splash seed, what noise() and hash()
+	// see
+	float p[OPS];
+	// Mostly short splash streaks, and some dolphin sized lines around the
+	// center
+	uint16_t line[LINES][4];
+	// The dolphin's four lines around the center, and those as sprites
+	uint16_t dolphin[POSES][4][4];
+	const struct Sprite *sprite[POSES];
+} in;
+
+static struct RenderContext ctx;
+// Whole frames, on a full canvas and in bands of BAND_ROWS, and on the
+// bigger canvases the game is compiled for
+static struct RenderContext frame_ctx, band_ctx, frame_800_ctx, frame_1280_ctx;
+#define BAND_ROWS 8
+static float wave[MAX_WIDTH];
+static int16_t seabed_row[MAX_WIDTH];
+static volatile float sink;
+
+// game.o wants a backend for process(), which we never call
+bool pump(struct RenderContext *ctx) {
+	return true;
+}
+
+static void bench_samplei(void *arg) {
+	float acc = 0.0f;
+	for(uint32_t i = 0; i < OPS; i++) {
+		acc += samplei(noiseTex, in.ix[i], in.iy[i]);
+	}
+	sink = acc;
+}
+
+static void bench_sample(void *arg) {
+	float acc = 0.0f;
+	for(uint32_t i = 0; i < OPS; i++) {
+		acc += sample(noiseTex, in.fx[i], in.fy[i]);
+	}
+	sink = acc;
+}
+
+static void bench_hash(void *arg) {
+	float acc = 0.0f;
+	for(uint32_t i = 0; i < OPS; i++) {
+		acc += hash(in.p[i]);
+	}
+	sink = acc;
+}
+
+static void bench_noise(void *arg) {
+	float acc = 0.0f;
+	for(uint32_t i = 0; i < OPS; i++) {
+		acc += noise(in.p[i]);
+	}
+	sink = acc;
+}
+
+static void bench_plotLine(void *arg) {
+	for(uint32_t i = 0; i < LINES; i++) {
+		plotLine(&ctx, in.line[i][0], in.line[i][1], in.line[i][2], in.line[i][3], 1, i & 1);
+	}
+}
+
+static void bench_dolphin_lines(void *arg) {
+	for(uint32_t i = 0; i < POSES; i++) {
+		for(uint8_t l = 0; l < 4; l++) {
+			const uint16_t *d = in.dolphin[i][l];
+			plotLine(&ctx, d[0], d[1], d[2], d[3], 1, i & 1);
+		}
+	}
+}
+
+static void bench_dolphin_sprite(void *arg) {
+	const struct Rect screen = { 0, 0, WIDTH, HEIGHT };
+	for(uint32_t i = 0; i < POSES; i++) {
+		sprite_blit(&ctx, in.sprite[i], WIDTH/2, HEIGHT/2, i & 1, &screen);
+	}
+}
+
+static void bench_text(void *arg) {
+	text("FPS 60", ctx.buffer, ctx.stride);
+}
+
+// A row of the wave at a width, with the kernel compiled for it or the
+// generic one
+struct WaveRow {
+	uint16_t width;
+	bool generic;
+};
+
+static void bench_wave(void *arg) {
+	const struct WaveRow *row = arg;
+	static float t = 0.0f;
+	t += 0.01667f;
+	genericKernels = row->generic;
+	waveLine(wave, row->width, t * 30, t);
+	genericKernels = false;
+}
+
+static const struct WaveRow wave_rows[] = {
+	{ 400, false }, { 400, true }, { 1280, false }, { 1280, true },
+};
+
+static void band_done(struct RenderContext *ctx, uint16_t y0, uint16_t y1) {
+}
+
+static void bench_frame(void *arg) {
+	process(arg);
+}
+
+struct Camera {
+	int32_t x;
+	int32_t y;
+};
+
+static void bench_background(void *arg) {
+	const struct Camera *camera = arg;
+	static float t = 0.0f;
+	t += 0.01667f;
+	shadeBackground(&ctx, wave, seabed_row, camera->x, camera->y, t);
+}
+
+// The cloud and foam layers' lookups over the whole screen, on a given mip
+// level. Level 0 is what the shader does, the smaller levels are what it
+// would cost to walk a smaller texture in the same pattern.
+struct MipWalk {
+	bool cloud;
+	uint8_t level;
+};
+
+static void bench_mip(void *arg) {
+	const struct MipWalk *w = arg;
+	static float t = 0.0f;
+	t += 0.01667f;
+	float acc = 0.0f;
+	// Camera where both layers cover the screen
+	int32_t x = 390, y = -20;
+	for(uint16_t sy = 0; sy < HEIGHT; sy++) {
+		int16_t ly = (-y - HEIGHT/2) + sy;
+		for(uint16_t sx = 0; sx < WIDTH; sx++) {
+			int16_t lx = (x - WIDTH/2) + sx;
+			if(w->cloud) {
+				acc += samplem(&noiseMip, w->level, (lx/4.0f)-t*10.0f, ly/2.0f);
+			} else {
+				acc += samplem(&noiseMip, w->level, abs(lx/2), abs(ly/2));
+			}
+		}
+	}
+	sink = acc;
+}
+
+static const struct MipWalk mip_walks[] = {
+	{ true, 0 }, { true, 1 }, { true, 2 },
+	{ false, 0 }, { false, 1 }, { false, 2 },
+};
+
+// A chunk of the world as the prefetch thread makes it, a different one
+// every call
+static void bench_chunk(void *arg) {
+	static struct Chunk chunk;
+	static int32_t index = 0;
+	world_generate(&chunk, 1, index++);
+	sink = chunk.seabed[0];
+}
+
+static const struct Camera surface = { 120, 0 };
+static const struct Camera seabed = { 160, -500 };
+static const struct Camera sky = { 390, 380 };
+
+struct Kernel {
+	const char *name;
+	void (*fn)(void *arg);
+	const void *arg;
+	// Operations per call, and pixels per operation for the ones that
+	// draw
+	uint32_t ops;
+	uint32_t pixels;
+};
+
+static const struct Kernel kernels[] = {
+	{ "samplei", bench_samplei, NULL, OPS, 0 },
+	{ "sample", bench_sample, NULL, OPS, 0 },
+	{ "hash", bench_hash, NULL, OPS, 0 },
+	{ "noise", bench_noise, NULL, OPS, 0 },
+	{ "plotLine", bench_plotLine, NULL, LINES, 0 },
+	{ "dolphin-lines", bench_dolphin_lines, NULL, POSES, 0 },
+	{ "dolphin-sprite", bench_dolphin_sprite, NULL, POSES, 0 },
+	{ "text", bench_text, NULL, 1, 6 * 8 * 8 },
+	{ "chunk-generate", bench_chunk, NULL, 1, CHUNK_WIDTH },
+	{ "wave", bench_wave, &wave_rows[0], 1, 400 },
+	{ "wave-generic", bench_wave, &wave_rows[1], 1, 400 },
+	{ "wave-1280", bench_wave, &wave_rows[2], 1, 1280 },
+	{ "wave-1280-generic", bench_wave, &wave_rows[3], 1, 1280 },
+	{ "background-surface", bench_background, &surface, 1, WIDTH * HEIGHT },
+	{ "background-seabed", bench_background, &seabed, 1, WIDTH * HEIGHT },
+	{ "background-sky", bench_background, &sky, 1, WIDTH * HEIGHT },
+	{ "mip-cloud-0", bench_mip, &mip_walks[0], WIDTH * HEIGHT, 1 },
+	{ "mip-cloud-1", bench_mip, &mip_walks[1], WIDTH * HEIGHT, 1 },
+	{ "mip-cloud-2", bench_mip, &mip_walks[2], WIDTH * HEIGHT, 1 },
+	{ "mip-foam-0", bench_mip, &mip_walks[3], WIDTH * HEIGHT, 1 },
+	{ "mip-foam-1", bench_mip, &mip_walks[4], WIDTH * HEIGHT, 1 },
+	{ "mip-foam-2", bench_mip, &mip_walks[5], WIDTH * HEIGHT, 1 },
+	{ "frame", bench_frame, &frame_ctx, 1, WIDTH * HEIGHT },
+	{ "frame-bands", bench_frame, &band_ctx, 1, WIDTH * HEIGHT },
+	{ "frame-800x480", bench_frame, &frame_800_ctx, 1, 800 * 480 },
+	{ "frame-1280x720", bench_frame, &frame_1280_ctx, 1, 1280 * 720 },
+};
+
+static int16_t clamp16(int v, int min, int max) {
+	return v < min ? min : v > max ? max : v;
+}
+
+static void make_inputs(void) {
+	srand(1);
+	for(uint32_t i = 0; i < OPS; i++) {
+		// lx/2, ly/2 for a camera wandering down through the water
+		int16_t lx = (i * 7) % WIDTH - WIDTH/2 + (i / WIDTH) * 13;
+		int16_t ly = rand() % HEIGHT - HEIGHT/2 - (i / 64);
+		in.ix[i] = abs(lx / 2);
+		in.iy[i] = abs(ly / 2);
+		in.fx[i] = rand() % (512 * 64) / 64.0f;
+		in.fy[i] = rand() % (512 * 64) / 64.0f;
+		in.p[i] = (i & 0x3F) ^ (i & 0x40 ? 0x40 : 0) ^ (rand() & 0xFF);
+	}
+	for(uint32_t i = 0; i < LINES; i++) {
+		int x = rand() % WIDTH, y = rand() % HEIGHT;
+		int len = i % 5 == 0 ? 30 : 8;
+		if(i % 5 == 0) {
+			x = WIDTH/2 + rand() % 30 - 15;
+			y = HEIGHT/2 + rand() % 30 - 15;
+		}
+		in.line[i][0] = clamp16(x, 0, WIDTH - 1);
+		in.line[i][1] = clamp16(y, 0, HEIGHT - 1);
+		in.line[i][2] = clamp16(x + rand() % (2*len + 1) - len, 0, WIDTH - 1);
+		in.line[i][3] = clamp16(y + rand() % (2*len + 1) - len, 0, HEIGHT - 1);
+	}
+	for(uint32_t i = 0; i < POSES; i++) {
+		// Same lines as the game draws for the angle
+		float a = i * 0.1f;
+		float tx = fcosf(a), ty = fsinf(a);
+		float hx = fcosf(a + 0.3f), hy = fsinf(a + 0.3f);
+		uint16_t (*d)[4] = in.dolphin[i];
+		uint16_t cx = WIDTH/2, cy = HEIGHT/2;
+		uint16_t lines[4][4] = {
+			{ cx - tx*25, cy + ty*25, cx + ty*5, cy + tx*5 },
+			{ cx - tx*25, cy + ty*25, cx - ty*5, cy - tx*5 },
+			{ cx + hy*5, cy + hx*5, cx + hx*10, cy - hy*10 },
+			{ cx - hy*5, cy - hx*5, cx + hx*10, cy - hy*10 },
+		};
+		memcpy(d, lines, sizeof(lines));
+		struct SpriteKey key = { .fill = 1 };
+		for(uint8_t l = 0; l < 4; l++) {
+			sprite_key_line(&key, cx, cy, d[l][0], d[l][1], d[l][2], d[l][3]);
+		}
+		in.sprite[i] = sprite_get(&key);
+	}
+	waveLine(wave, WIDTH, 0, 0.0f);
+	// The seabed under the seabed camera, the other ones don't see it
+	world_reset(1);
+	world_frame(seabed.x - WIDTH/2, seabed.x + WIDTH/2, 0.0f);
+	world_seabed_row(seabed_row, seabed.x - WIDTH/2, WIDTH);
+}
+
+int main(int argc, char *argv[]) {
+	bool csv = false;
+	const char *only = NULL;
+	uint32_t target_ms = 200;
+	for(int opt; (opt = getopt(argc, argv, "ck:m:")) != -1;) {
+		switch(opt) {
+			case 'c':
+				csv = true;
+				break;
+			case 'k':
+				only = optarg;
+				break;
+			case 'm':
+				target_ms = strtoul(optarg, NULL, 10);
+				break;
+			default:
+				fprintf(stderr, "Usage: %s [-c] [-k kernel] [-m ms per kernel]\n", argv[0]);
+				return 1;
+		}
+	}
+
+	// Builds with ASSETS=PACK don't point at these by themselves
+	noiseTex = &noiseTexture;
+	ditherTex = &ditherTexture;
+	font = font8x8_basic;
+	void *mips = malloc(mip_size(noiseTex));
+	mip_build(&noiseMip, noiseTex, mips);
+
+	ctx.width = WIDTH;
+	ctx.height = HEIGHT;
+	ctx.stride = WIDTH * 4;
+	ctx.buffer = calloc(HEIGHT, ctx.stride);
+	frame_ctx = ctx;
+	frame_ctx.buffer = calloc(HEIGHT, frame_ctx.stride);
+	band_ctx = ctx;
+	band_ctx.band_rows = BAND_ROWS;
+	band_ctx.band = band_done;
+	band_ctx.buffer = calloc(BAND_ROWS, band_ctx.stride);
+	frame_800_ctx = (struct RenderContext){ .width = 800, .height = 480, .stride = 800 * 4 };
+	frame_800_ctx.buffer = calloc(480, frame_800_ctx.stride);
+	frame_1280_ctx = (struct RenderContext){ .width = 1280, .height = 720, .stride = 1280 * 4 };
+	frame_1280_ctx.buffer = calloc(720, frame_1280_ctx.stride);
+	make_inputs();
+	// The frame kernels play the game from where it starts, entities and all
+	game_reset(1);
+
+	if(csv) {
+		printf("arch,kernel,ops,reps,ns_per_op,stddev_ns,min_ns,mpixels_per_s,cycles_per_op,instructions_per_op,cache_misses_per_op\n");
+	} else {
+		printf("%s\n", ARCH);
+		printf("%-19s %10s %9s %10s %9s %9s %9s %9s\n", "kernel", "ns/op", "stddev", "min", "Mpixel/s", "cycles", "insns", "misses");
+	}
+
+	for(size_t i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++) {
+		const struct Kernel *k = &kernels[i];
+		if(only != NULL && strcmp(only, k->name) != 0) {
+			continue;
+		}
+		void *arg = (void *)k->arg;
+
+		// Aim for about target_ms of timed calls, whatever the kernel costs
+		uint64_t start = prof_now();
+		k->fn(arg);
+		uint64_t once = prof_now() - start + 1;
+		uint32_t reps = target_ms * 1000000ull / once;
+		if(reps < 10) reps = 10;
+		if(reps > 100000) reps = 100000;
+
+		struct BenchResult r = bench_run(k->fn, arg, reps / 10 + 1, reps);
+		double ns = r.mean_ns / k->ops;
+		double stddev = r.stddev_ns / k->ops;
+		double min = r.min_ns / k->ops;
+		double mpixels = k->pixels ? k->pixels / ns * 1e3 : 0.0;
+		if(csv) {
+			printf("%s,%s,%u,%u,%.3f,%.3f,%.3f,", ARCH, k->name, k->ops, r.reps, ns, stddev, min);
+			if(k->pixels) printf("%.3f", mpixels);
+			if(r.counters) {
+				printf(",%.2f,%.2f,%.4f\n", r.cycles / k->ops, r.instructions / k->ops, r.cache_misses / k->ops);
+			} else {
+				printf(",,,\n");
+			}
+		} else {
+			printf("%-19s %10.2f %9.2f %10.2f ", k->name, ns, stddev, min);
+			if(k->pixels) {
+				printf("%9.1f ", mpixels);
+			} else {
+				printf("%9s ", "-");
+			}
+			if(r.counters) {
+				printf("%9.1f %9.1f %9.3f\n", r.cycles / k->ops, r.instructions / k->ops, r.cache_misses / k->ops);
+			} else {
+				printf("%9s %9s %9s\n", "-", "-", "-");
+			}
+		}
+	}
+
+	free(mips);
+	free(band_ctx.buffer);
+	free(frame_ctx.buffer);
+	free(ctx.buffer);
+	return 0;
+}
@@ -0,0 +1,145 @@
+#include "asset.h"
+#include "game.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Writes an asset pack. Without options it packs the assets built into the
+// game, any of them can be replaced from a file.
+
+struct Asset {
+	const char *name;
+	enum AssetType type;
+	uint16_t flags;
+	const void *data;
+	size_t size;
+};
+
+// 8 bit PGM (P5) as a texture, header and all
+static struct Tex *read_pgm(const char *path, size_t *size) {
+	FILE *f = fopen(path, "rb");
+	if(f == NULL) {
+		fprintf(stderr, "Failed to open %s (%m)\n", path);
+		return NULL;
+	}
+	unsigned width, height, max;
+	struct Tex *tex = NULL;
+	if(fscanf(f, "P5 %u %u %u", &width, &height, &max) != 3 || max > 255 || width == 0 || height == 0 || fgetc(f) == EOF) {
+		fprintf(stderr, "%s is not an 8 bit PGM\n", path);
+		goto out;
+	}
+	*size = sizeof(struct Tex) + (size_t)width * height;
+	tex = malloc(*size);
+	tex->width = width;
+	tex->height = height;
+	if(fread(tex->data, 1, (size_t)width * height, f) != (size_t)width * height) {
+		fprintf(stderr, "%s is truncated\n", path);
+		free(tex);
+		tex = NULL;
+	}
+out:
+	fclose(f);
+	return tex;
+}
+
+static void *read_file(const char *path, size_t *size) {
+	FILE *f = fopen(path, "rb");
+	if(f == NULL) {
+		fprintf(stderr, "Failed to open %s (%m)\n", path);
+		return NULL;
+	}
+	fseek(f, 0, SEEK_END);
+	*size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	void *data = malloc(*size);
+	if(fread(data, 1, *size, f) != *size) {
+		free(data);
+		data = NULL;
+	}
+	fclose(f);
+	return data;
+}
+
+int main(int argc, char *argv[]) {
+	struct Asset assets[] = {
+		{ "noise", ASSET_TEX, 0, &noiseTexture, sizeof(struct Tex) + noiseTexture.width * noiseTexture.height },
+		{ "dither", ASSET_TEX, ASSET_WILLNEED, &ditherTexture, sizeof(struct Tex) + ditherTexture.width * ditherTexture.height },
+		{ "font", ASSET_RAW, ASSET_WILLNEED, font8x8_basic, sizeof(font8x8_basic) },
+	};
+	const uint16_t count = sizeof(assets) / sizeof(assets[0]);
+
+	const char *out = "flipper.pak";
+	for(int opt; (opt = getopt(argc, argv, "o:n:d:f:w:")) != -1;) {
+		switch(opt) {
+			case 'o':
+				out = optarg;
+				break;
+			case 'n':
+			case 'd': {
+				struct Asset *a = &assets[opt == 'n' ? 0 : 1];
+				a->data = read_pgm(optarg, &a->size);
+				if(a->data == NULL) {
+					return 1;
+				}
+				break;
+			}
+			case 'f':
+				assets[2].data = read_file(optarg, &assets[2].size);
+				if(assets[2].data == NULL || assets[2].size != sizeof(font8x8_basic)) {
+					fprintf(stderr, "%s is not a %zu byte font\n", optarg, sizeof(font8x8_basic));
+					return 1;
+				}
+				break;
+			case 'w':
+				for(uint16_t i = 0; i < count; i++) {
+					if(strcmp(assets[i].name, optarg) == 0) {
+						assets[i].flags |= ASSET_WILLNEED;
+					}
+				}
+				break;
+			default:
+				fprintf(stderr, "Usage: %s [-o pack] [-n noise.pgm] [-d dither.pgm] [-f font] [-w name]...\n", argv[0]);
+				return 1;
+		}
+	}
+
+	FILE *f = fopen(out, "wb");
+	if(f == NULL) {
+		fprintf(stderr, "Failed to write %s (%m)\n", out);
+		return 1;
+	}
+
+	struct AssetHeader header = {
+		.magic = ASSET_MAGIC,
+		.version = ASSET_VERSION,
+		.count = count,
+	};
+	struct AssetEntry dir[count];
+	memset(dir, 0, sizeof(dir));
+	uint32_t offset = sizeof(header) + sizeof(dir);
+	for(uint16_t i = 0; i < count; i++) {
+		offset = (offset + ASSET_ALIGN - 1) / ASSET_ALIGN * ASSET_ALIGN;
+		strncpy(dir[i].name, assets[i].name, ASSET_NAME_MAX - 1);
+		dir[i].type = assets[i].type;
+		dir[i].flags = assets[i].flags;
+		dir[i].offset = offset;
+		dir[i].size = assets[i].size;
+		offset += assets[i].size;
+	}
+
+	fwrite(&header, sizeof(header), 1, f);
+	fwrite(dir, sizeof(dir), 1, f);
+	for(uint16_t i = 0; i < count; i++) {
+		static const uint8_t zero[ASSET_ALIGN];
+		fwrite(zero, 1, dir[i].offset - ftell(f), f);
+		fwrite(assets[i].data, 1, assets[i].size, f);
+		printf("%-8s %7zu bytes at %7u%s\n", assets[i].name, assets[i].size, dir[i].offset, assets[i].flags & ASSET_WILLNEED ? ", read ahead" : "");
+	}
+	if(fclose(f) != 0) {
+		fprintf(stderr, "Failed to write %s (%m)\n", out);
+		return 1;
+	}
+	return 0;
+}
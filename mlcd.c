@@ -0,0 +1,287 @@
+#include "render.h"
+#include "convert.h"
+#include "draw.h"
+#include "input.h"
+#include "mem.h"
+#include "mlcd.h"
+#include "prof.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include <linux/spi/spidev.h>
+
+// Sharp memory LCD on spidev, see mlcd.h for the protocol. The panel keeps
+// what it was sent, so every frame only the lines that differ from what it
+// has go out, packed into as few transfers as spidev takes.
+//
+// Configured through the environment:
+//   FLIPPER_MLCD     The spidev device, default /dev/spidev0.0. Anything
+//                    else that can be written to works too (say a fifo
+//                    mlcdview reads), the SPI setup is skipped for those.
+//   FLIPPER_MLCD_HZ  SPI clock, default 2 MHz
+//   FLIPPER_BAND     Draw the frame in bands of this many rows, and send
+//                    each band's lines as soon as it's done
+
+struct mlcd {
+	int fd;
+	const struct Converter *convert;
+	// What the panel shows, as MONO10 rows
+	uint8_t sent[HEIGHT][MLCD_LINE_BYTES];
+	uint8_t tx[MLCD_MAX_TRANSFER];
+	// Bytes in tx so far, the mode byte included
+	size_t len;
+
+	uint8_t vcom;
+	bool vcom_due;
+	uint64_t vcom_flipped;
+
+	// The frame being sent
+	uint32_t frame_lines;
+	uint32_t frame_bytes;
+	uint64_t frame_ns;
+
+	// Per frame stats
+	uint32_t frames;
+	uint32_t idle;
+	uint64_t lines;
+	uint64_t bytes;
+	uint32_t transfers;
+	uint32_t max_lines;
+	uint32_t max_bytes;
+	uint64_t write_ns;
+	uint64_t max_write_ns;
+};
+
+static void transfer(struct mlcd *m, const uint8_t *data, size_t len) {
+	ssize_t n = write(m->fd, data, len);
+	if(n != (ssize_t)len) {
+		fprintf(stderr, "Failed to write to the panel (%s)\n", n < 0 ? strerror(errno) : "short write");
+		exit(1);
+	}
+	m->transfers++;
+	m->vcom_due = false;
+}
+
+// The mode byte goes in front of the lines in tx, the closing dummy byte
+// after them
+static size_t flush(struct mlcd *m, size_t len) {
+	m->tx[0] = MLCD_WRITE | m->vcom;
+	m->tx[len] = 0;
+	transfer(m, m->tx, len + 1);
+	return len + 1;
+}
+
+// Nothing but the mode byte with VCOM, which has to go out when it flips
+// with no lines to carry it
+static size_t hold(struct mlcd *m) {
+	const uint8_t mode[2] = { m->vcom, 0 };
+	transfer(m, mode, sizeof(mode));
+	return sizeof(mode);
+}
+
+static void setup_spi(struct mlcd *m, const char *path) {
+	// Chip select is active high on these
+	uint8_t mode = SPI_MODE_0 | SPI_CS_HIGH;
+	uint8_t bits = 8;
+	uint32_t hz = 2000000;
+	if(getenv("FLIPPER_MLCD_HZ") != NULL) {
+		hz = strtoul(getenv("FLIPPER_MLCD_HZ"), NULL, 10);
+	}
+	if(ioctl(m->fd, SPI_IOC_WR_MODE, &mode) < 0) {
+		if(errno == ENOTTY) {
+			printf("Panel: %s is not spidev, writing the bare stream\n", path);
+			return;
+		}
+		perror("SPI_IOC_WR_MODE");
+		exit(1);
+	}
+	if(ioctl(m->fd, SPI_IOC_WR_BITS_PER_WORD, &bits) < 0 || ioctl(m->fd, SPI_IOC_WR_MAX_SPEED_HZ, &hz) < 0) {
+		perror("SPI setup");
+		exit(1);
+	}
+	printf("Panel: %s at %u Hz\n", path, hz);
+}
+
+// Add the lines from y0 to y1 the panel doesn't have yet to the transfer
+// being built, and send it whenever it's full. In band mode this gets each
+// band as it's drawn.
+static void send_rows(struct RenderContext *ctx, uint16_t y0, uint16_t y1) {
+	struct mlcd *m = ctx->mlcd;
+	uint64_t start = prof_now();
+
+	// Lines are converted straight into the transfer, and dropped again if
+	// the panel already has them
+	for(uint16_t y = y0; y < y1; y++) {
+		uint8_t *line = m->tx + m->len;
+		m->convert->row(line + 1, ctx->buffer + (y - y0) * ctx->stride, WIDTH);
+		if(memcmp(line + 1, m->sent[y], MLCD_LINE_BYTES) == 0) {
+			continue;
+		}
+		memcpy(m->sent[y], line + 1, MLCD_LINE_BYTES);
+		line[0] = mlcd_address(y);
+		line[MLCD_LINE_SIZE - 1] = 0;
+		m->len += MLCD_LINE_SIZE;
+		m->frame_lines++;
+
+		// Room for one more line and the closing byte?
+		if(m->len + MLCD_LINE_SIZE + 1 > MLCD_MAX_TRANSFER) {
+			m->frame_bytes += flush(m, m->len);
+			m->len = 1;
+		}
+	}
+	m->frame_ns += prof_now() - start;
+}
+
+void init_render(struct RenderContext *ctx) {
+	// Discovery runs on the input thread while we bring up the display
+	ctx->input = input_start();
+	prof_phase("input start");
+
+	struct mlcd *m = calloc(1, sizeof(struct mlcd));
+	assert(m != NULL);
+	ctx->mlcd = m;
+
+	const char *path = getenv("FLIPPER_MLCD") != NULL ? getenv("FLIPPER_MLCD") : MLCD_DEVICE;
+	m->fd = open(path, O_WRONLY | O_CLOEXEC);
+	if(m->fd < 0) {
+		fprintf(stderr, "Failed to open %s (%m)\n", path);
+		exit(1);
+	}
+	setup_spi(m, path);
+	m->convert = convert_find(PF_MONO10);
+
+	// Start from a white panel, which is what sent says it has
+	const uint8_t clear[2] = { MLCD_CLEAR, 0 };
+	transfer(m, clear, sizeof(clear));
+	m->transfers = 0;
+	memset(m->sent, 0xFF, sizeof(m->sent));
+	m->len = 1;
+	m->vcom_flipped = prof_now();
+	prefault(m, sizeof(struct mlcd), true);
+	prof_phase("panel");
+
+	// The panel has no other size, so neither has the canvas. send_rows()
+	// sends whole lines of it.
+	if(getenv("FLIPPER_SIZE") != NULL) {
+		fprintf(stderr, "FLIPPER_SIZE doesn't work with the panel, drawing at %ux%u\n", WIDTH, HEIGHT);
+	}
+	ctx->width = WIDTH;
+	ctx->height = HEIGHT;
+
+	// Lines go out as they're drawn in band mode, and the panel keeps them.
+	// Nothing the size of a frame is left but sent.
+	ctx->band_rows = draw_band_rows(ctx);
+	uint16_t rows = ctx->band_rows != 0 ? ctx->band_rows : HEIGHT;
+	if(ctx->band_rows != 0) {
+		ctx->band = send_rows;
+		printf("Drawing in bands of %u rows, %u bytes\n", rows, WIDTH * rows * 4);
+	}
+	ctx->buffer = mem_alloc(WIDTH * rows * 4);
+	assert(ctx->buffer != NULL);
+	prefault(ctx->buffer, WIDTH * rows * 4, true);
+	ctx->stride = WIDTH * 4;
+	ctx->vsync = false;
+	prof_phase("canvas");
+
+	memset(ctx->keys, 0, KC_LAST * sizeof(uint8_t));
+
+	uint32_t wait = 1000;
+	if(getenv("FLIPPER_INPUT_WAIT") != NULL) {
+		wait = atoi(getenv("FLIPPER_INPUT_WAIT"));
+	}
+	if(!input_wait(ctx->input, wait)) {
+		fprintf(stderr, "No keyboard found yet, starting without one\n");
+	}
+	prof_phase("keyboard");
+}
+
+bool pump(struct RenderContext *ctx) {
+	input_poll(ctx->input, ctx->keys);
+	return true;
+}
+
+// Frames aren't sent while nothing changes, but VCOM still has to flip on
+// time, so the sleep is cut short for that
+bool wait_input(struct RenderContext *ctx, uint32_t us) {
+	struct mlcd *m = ctx->mlcd;
+	uint64_t end = prof_now() + us * 1000ull;
+	for(;;) {
+		uint64_t now = prof_now();
+		if(now - m->vcom_flipped >= MLCD_VCOM_NS) {
+			m->vcom ^= MLCD_VCOM;
+			m->vcom_flipped = now;
+			hold(m);
+		}
+		if(now >= end) {
+			return false;
+		}
+		uint64_t until = m->vcom_flipped + MLCD_VCOM_NS < end ? m->vcom_flipped + MLCD_VCOM_NS : end;
+		if(input_sleep(ctx->input, (until - now + 999) / 1000)) {
+			return true;
+		}
+	}
+}
+
+void render(struct RenderContext *ctx) {
+	struct mlcd *m = ctx->mlcd;
+	if(ctx->band_rows == 0) {
+		send_rows(ctx, 0, HEIGHT);
+	}
+
+	uint64_t start = prof_now();
+	if(start - m->vcom_flipped >= MLCD_VCOM_NS) {
+		m->vcom ^= MLCD_VCOM;
+		m->vcom_flipped = start;
+		m->vcom_due = true;
+	}
+	if(m->len > 1) {
+		m->frame_bytes += flush(m, m->len);
+		m->len = 1;
+	} else if(m->vcom_due) {
+		m->frame_bytes += hold(m);
+	}
+	m->frame_ns += prof_now() - start;
+
+	m->frames++;
+	m->idle += m->frame_lines == 0;
+	m->lines += m->frame_lines;
+	m->bytes += m->frame_bytes;
+	m->write_ns += m->frame_ns;
+	if(m->frame_lines > m->max_lines) m->max_lines = m->frame_lines;
+	if(m->frame_bytes > m->max_bytes) m->max_bytes = m->frame_bytes;
+	if(m->frame_ns > m->max_write_ns) m->max_write_ns = m->frame_ns;
+	m->frame_lines = 0;
+	m->frame_bytes = 0;
+	m->frame_ns = 0;
+}
+
+void stop(struct RenderContext *ctx) {
+	struct mlcd *m = ctx->mlcd;
+	input_stop(ctx->input);
+
+	if(m->frames > 0) {
+		const uint32_t full = 2 + HEIGHT * MLCD_LINE_SIZE;
+		printf(
+			"Panel: %u frames (%u unchanged), per frame %.1f lines %.0f bytes (max %u lines %u bytes), %.1f%% of sending every line, %u transfers, update avg %.3f ms max %.3f ms\n",
+			m->frames, m->idle,
+			m->lines / (double)m->frames, m->bytes / (double)m->frames,
+			m->max_lines, m->max_bytes,
+			100.0 * m->bytes / ((double)full * m->frames),
+			m->transfers,
+			m->write_ns / (double)m->frames / 1e6, m->max_write_ns / 1e6
+		);
+	}
+
+	const uint8_t clear[2] = { MLCD_CLEAR | m->vcom, 0 };
+	transfer(m, clear, sizeof(clear));
+	close(m->fd);
+	free(m);
+	mem_free(ctx->buffer);
+}
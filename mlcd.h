@@ -0,0 +1,50 @@
+#pragma once
+
+#include "render.h"
+
+#include <stdint.h>
+
+// Line update protocol of the Sharp memory LCDs (LS027B7DH01 and friends),
+// as it goes over SPI most significant bit first. One transfer, with chip
+// select held, is
+//   a mode byte
+//   for every line: its address, MLCD_LINE_BYTES of pixels and a dummy byte
+//   one more dummy byte
+// The address is the 1 based line number with its bits reversed, the panel
+// takes it least significant bit first. Pixels are 1 for white with the
+// leftmost one first, which is a MONO10 row as it is. Lines don't have to be
+// next to each other. Since no line has address 0, the closing dummy byte is
+// also how a reader of the stream knows the transfer ended.
+//
+// MLCD_VCOM has to be flipped regularly or the liquid crystal builds up a
+// DC bias. A transfer without MLCD_WRITE is just the mode byte and a dummy
+// byte, that's how VCOM flips while nothing on screen changes.
+
+#define MLCD_WRITE 0x80
+#define MLCD_VCOM 0x40
+#define MLCD_CLEAR 0x20
+
+#define MLCD_LINE_BYTES (WIDTH / 8)
+// Address, pixels and the dummy byte
+#define MLCD_LINE_SIZE (MLCD_LINE_BYTES + 2)
+
+#define MLCD_DEVICE "/dev/spidev0.0"
+// spidev takes at most its bufsiz per write, 4096 unless the module was
+// loaded with something else
+#define MLCD_MAX_TRANSFER 4096
+// Flip VCOM twice a second, the 1 Hz square wave EXTCOMIN would get in
+// hardware mode
+#define MLCD_VCOM_NS 500000000ull
+
+static inline uint8_t mlcd_reverse(uint8_t b) {
+	uint8_t rev = 0;
+	for(uint8_t i = 0; i < 8; i++) {
+		rev = rev << 1 | ((b >> i) & 1);
+	}
+	return rev;
+}
+
+// Address of canvas row y
+static inline uint8_t mlcd_address(uint16_t y) {
+	return mlcd_reverse(y + 1);
+}
@@ -0,0 +1,158 @@
+#include "mlcd.h"
+#include "prof.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// Stands in for the panel of RENDER=MLCD. Reads the SPI stream from a fifo
+// (made if it isn't there yet) or stdin, keeps the panel memory up to date
+// and checks the stream on the way: mode bits, addresses, dummy bytes and
+// how long VCOM is left alone. Reports what it got when the game closes the
+// stream. With -o what the panel shows after every transfer with lines in it
+// is written as a PBM, a frame that took more than one transfer shows up
+// partly drawn in between.
+//
+//   ./mlcdview -o panel- /tmp/lcd &
+//   FLIPPER_MLCD=/tmp/lcd ./main
+
+static uint8_t panel[HEIGHT][MLCD_LINE_BYTES];
+
+static bool write_pbm(const char *prefix, uint32_t number) {
+	char path[256];
+	snprintf(path, sizeof(path), "%s%06u.pbm", prefix, number);
+	FILE *f = fopen(path, "wb");
+	if(f == NULL) {
+		fprintf(stderr, "Failed to write %s (%m)\n", path);
+		return false;
+	}
+	// PBM is 1 for black, the panel 1 for white
+	fprintf(f, "P4\n%u %u\n", WIDTH, HEIGHT);
+	for(uint16_t y = 0; y < HEIGHT; y++) {
+		uint8_t row[MLCD_LINE_BYTES];
+		for(uint16_t i = 0; i < MLCD_LINE_BYTES; i++) {
+			row[i] = ~panel[y][i];
+		}
+		fwrite(row, 1, sizeof(row), f);
+	}
+	return fclose(f) == 0;
+}
+
+int main(int argc, char *argv[]) {
+	const char *prefix = NULL;
+	for(int opt; (opt = getopt(argc, argv, "o:")) != -1;) {
+		switch(opt) {
+			case 'o':
+				prefix = optarg;
+				break;
+			default:
+				goto usage;
+		}
+	}
+	if(argc - optind > 1) {
+		goto usage;
+	}
+
+	FILE *f = stdin;
+	if(optind < argc) {
+		const char *path = argv[optind];
+		if(mkfifo(path, 0666) != 0 && errno != EEXIST) {
+			fprintf(stderr, "Failed to create %s (%m)\n", path);
+			return 1;
+		}
+		f = fopen(path, "rb");
+		if(f == NULL) {
+			fprintf(stderr, "Failed to open %s (%m)\n", path);
+			return 1;
+		}
+	}
+
+	uint64_t bytes = 0;
+	uint32_t transfers = 0, writes = 0, lines = 0, clears = 0, flips = 0;
+	uint8_t vcom = 0;
+	uint64_t vcom_since = 0, longest_hold = 0;
+	const char *error = NULL;
+
+	for(int mode; (mode = getc(f)) != EOF;) {
+		uint64_t now = prof_now();
+		if(transfers++ == 0) {
+			vcom_since = now;
+		}
+		bytes++;
+		if(mode & ~(MLCD_WRITE | MLCD_VCOM | MLCD_CLEAR)) {
+			error = "reserved mode bits set";
+			break;
+		}
+		if((mode & MLCD_VCOM) != vcom) {
+			vcom = mode & MLCD_VCOM;
+			flips++;
+			if(now - vcom_since > longest_hold) {
+				longest_hold = now - vcom_since;
+			}
+			vcom_since = now;
+		}
+		if(mode & MLCD_CLEAR) {
+			memset(panel, 0xFF, sizeof(panel));
+			clears++;
+		}
+
+		if(!(mode & MLCD_WRITE)) {
+			bytes++;
+			if(getc(f) != 0) {
+				error = "no dummy byte after the mode byte";
+				break;
+			}
+			continue;
+		}
+
+		writes++;
+		for(;;) {
+			int address = getc(f);
+			bytes++;
+			if(address == EOF) {
+				error = "stream ended inside a transfer";
+				break;
+			}
+			if(address == 0) {
+				break;
+			}
+			uint16_t y = mlcd_reverse(address) - 1;
+			if(y >= HEIGHT) {
+				error = "address past the last line";
+				break;
+			}
+			if(fread(panel[y], 1, MLCD_LINE_BYTES, f) != MLCD_LINE_BYTES || getc(f) != 0) {
+				error = "line without its dummy byte";
+				break;
+			}
+			bytes += MLCD_LINE_BYTES + 1;
+			lines++;
+		}
+		if(error != NULL) {
+			break;
+		}
+		if(prefix != NULL && !write_pbm(prefix, writes)) {
+			return 1;
+		}
+	}
+	if(transfers > 0 && prof_now() - vcom_since > longest_hold) {
+		longest_hold = prof_now() - vcom_since;
+	}
+
+	printf(
+		"%u transfers, %u with lines, %u lines (%.1f per write), %llu bytes, %u clears\n",
+		transfers, writes, lines, writes ? lines / (double)writes : 0.0, (unsigned long long)bytes, clears
+	);
+	printf("VCOM flipped %u times, held for at most %.0f ms\n", flips, longest_hold / 1e6);
+	if(error != NULL) {
+		fprintf(stderr, "Bad stream at byte %llu: %s\n", (unsigned long long)bytes, error);
+	}
+	return error != NULL ? 1 : 0;
+
+usage:
+	fprintf(stderr, "Usage: %s [-o prefix] [fifo]\n", argv[0]);
+	return 1;
+}
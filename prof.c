@@ -0,0 +1,133 @@
+#include "prof.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_PHASES 16
+// Frame intervals are bucketed by 0.1 ms up to 50 ms
+#define FRAME_BUCKETS 500
+#define FRAME_BUCKET_NS 100000
+
+struct phase {
+	const char *name;
+	uint64_t at;
+};
+
+static struct phase phases[MAX_PHASES];
+static uint8_t nphases = 0;
+// Time since boot when the first phase was marked. The monotonic clock
+// doesn't count suspend, but we're measuring from a cold boot.
+static uint64_t boot_offset = 0;
+
+uint64_t prof_now(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+void prof_phase(const char *name) {
+	if(nphases == 0) {
+		struct timespec boot;
+		clock_gettime(CLOCK_BOOTTIME, &boot);
+		boot_offset = boot.tv_sec * 1000000000ull + boot.tv_nsec;
+	}
+	if(nphases >= MAX_PHASES) {
+		return;
+	}
+	phases[nphases].name = name;
+	phases[nphases].at = prof_now();
+	nphases++;
+}
+
+// When the kernel started us, in ns since boot. Only has clock tick
+// resolution.
+static uint64_t process_start(void) {
+	FILE *f = fopen("/proc/self/stat", "r");
+	if(f == NULL) {
+		return 0;
+	}
+	char stat[1024];
+	bool read = fgets(stat, sizeof(stat), f) != NULL;
+	fclose(f);
+
+	// The command name can contain spaces and parens, so count fields from
+	// after its last closing paren. That's field 2, starttime is field 22.
+	char *after = read ? strrchr(stat, ')') : NULL;
+	unsigned long long ticks;
+	if(after == NULL || sscanf(after + 1, "%*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %llu", &ticks) != 1) {
+		return 0;
+	}
+	return ticks * (1000000000ull / sysconf(_SC_CLK_TCK));
+}
+
+void prof_startup_report(void) {
+	if(nphases == 0) {
+		return;
+	}
+
+	uint64_t start = process_start();
+	printf("Startup:\n");
+	if(start != 0 && start < boot_offset) {
+		printf("  %-12s %8.2f ms\n", "exec", (boot_offset - start) / 1e6);
+	}
+	for(uint8_t i = 1; i < nphases; i++) {
+		printf("  %-12s %8.2f ms\n", phases[i].name, (phases[i].at - phases[i-1].at) / 1e6);
+	}
+	uint64_t total = phases[nphases-1].at - phases[0].at;
+	printf("  %-12s %8.2f ms (%.2f ms since boot)\n", "first frame", total / 1e6, (boot_offset + total) / 1e6);
+}
+
+static struct {
+	uint32_t count;
+	uint64_t min;
+	uint64_t max;
+	// Running mean and sum of squared deviations (Welford)
+	double mean;
+	double m2;
+	uint32_t buckets[FRAME_BUCKETS];
+} frames = {0};
+
+void prof_frame(uint64_t interval_ns) {
+	if(frames.count == 0 || interval_ns < frames.min) frames.min = interval_ns;
+	if(interval_ns > frames.max) frames.max = interval_ns;
+
+	frames.count++;
+	double delta = interval_ns - frames.mean;
+	frames.mean += delta / frames.count;
+	frames.m2 += delta * (interval_ns - frames.mean);
+
+	uint64_t bucket = interval_ns / FRAME_BUCKET_NS;
+	frames.buckets[bucket < FRAME_BUCKETS ? bucket : FRAME_BUCKETS - 1]++;
+}
+
+static double percentile(double p) {
+	uint32_t target = frames.count * p;
+	uint32_t seen = 0;
+	for(uint32_t i = 0; i < FRAME_BUCKETS; i++) {
+		seen += frames.buckets[i];
+		if(seen > target) {
+			return (i + 1) * FRAME_BUCKET_NS / 1e6;
+		}
+	}
+	return FRAME_BUCKETS * FRAME_BUCKET_NS / 1e6;
+}
+
+void prof_frame_report(const char *label) {
+	if(frames.count < 2) {
+		return;
+	}
+
+	double stddev = sqrt(frames.m2 / (frames.count - 1));
+	printf("Frame pacing (%s): %u frames\n", label, frames.count);
+	printf("  mean %.3f ms, jitter (stddev) %.3f ms\n", frames.mean / 1e6, stddev / 1e6);
+	printf("  min %.3f ms, p50 %.1f ms, p99 %.1f ms, max %.3f ms\n",
+		frames.min / 1e6,
+		percentile(0.50),
+		percentile(0.99),
+		frames.max / 1e6
+	);
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stdint.h>
+
+// CLOCK_MONOTONIC in nanoseconds
+uint64_t prof_now(void);
+
+// Startup timeline. Each call marks the end of a named phase, the report
+// breaks the time to first frame down by those phases.
+void prof_phase(const char *name);
+void prof_startup_report(void);
+
+// Frame pacing. Feed it the time between the starts of consecutive frames,
+// the report gives the distribution and jitter.
+void prof_frame(uint64_t interval_ns);
+void prof_frame_report(const char *label);
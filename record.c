@@ -0,0 +1,210 @@
+#include "record.h"
+#include "convert.h"
+#include "prof.h"
+#include "render.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// Room for the largest canvas, a recording uses the start of it
+#define FRAME_BYTES (MAX_WIDTH * MAX_HEIGHT / 8)
+
+static struct {
+	FILE *f;
+	// Set up front, the frame loop may not allocate
+	char iobuf[1 << 16];
+	uint8_t prev[FRAME_BYTES];
+	uint8_t cur[FRAME_BYTES];
+	uint8_t delta[FRAME_BYTES];
+	uint8_t payload[RECORD_MAX_PAYLOAD(FRAME_BYTES)];
+
+	const struct Converter *pack;
+	uint16_t width;
+	uint16_t height;
+	size_t frame_bytes;
+	uint64_t start;
+	uint64_t offset;
+	uint32_t frames;
+
+	uint64_t index[RECORD_INDEX_FRAMES];
+	uint32_t index_first;
+	uint16_t index_count;
+	uint64_t last_index;
+
+	uint64_t bytes;
+	uint64_t encode_ns;
+	uint64_t encode_max;
+} rec;
+
+size_t record_rle_encode(uint8_t *restrict out, const uint8_t *restrict in, size_t len) {
+	size_t o = 0;
+	size_t i = 0;
+	while(i < len) {
+		size_t run = 0;
+		while(i + run < len && in[i + run] == 0 && run < 128) {
+			run++;
+		}
+		if(run > 0) {
+			out[o++] = 0x80 | (run - 1);
+			i += run;
+			continue;
+		}
+
+		// Literals until the next pair of zeros, a lone zero is cheaper to
+		// keep in the literal run
+		size_t lit = 0;
+		while(i + lit < len && lit < 128
+				&& !(in[i + lit] == 0 && (i + lit + 1 == len || in[i + lit + 1] == 0))) {
+			lit++;
+		}
+		out[o++] = lit - 1;
+		memcpy(out + o, in + i, lit);
+		o += lit;
+		i += lit;
+	}
+	return o;
+}
+
+bool record_rle_decode(uint8_t *restrict out, size_t len, const uint8_t *restrict in, size_t in_len) {
+	size_t o = 0;
+	size_t i = 0;
+	while(i < in_len) {
+		uint8_t token = in[i++];
+		size_t n = (token & 0x7F) + 1;
+		if(o + n > len) {
+			return false;
+		}
+		if(token & 0x80) {
+			memset(out + o, 0, n);
+		} else {
+			if(i + n > in_len) {
+				return false;
+			}
+			memcpy(out + o, in + i, n);
+			i += n;
+		}
+		o += n;
+	}
+	return o == len;
+}
+
+static void write_chunk(const struct RecordChunk *chunk, const void *payload) {
+	fwrite(chunk, sizeof(*chunk), 1, rec.f);
+	fwrite(payload, 1, chunk->length, rec.f);
+	rec.offset += sizeof(*chunk) + chunk->length;
+}
+
+static void flush_index(void) {
+	if(rec.index_count == 0) {
+		return;
+	}
+
+	uint64_t prev = rec.last_index;
+	struct RecordChunk chunk = {
+		.type = 'I',
+		.length = sizeof(prev) + rec.index_count * sizeof(uint64_t),
+		.frame = rec.index_first,
+		.time = prof_now() - rec.start,
+	};
+	rec.last_index = rec.offset;
+	fwrite(&chunk, sizeof(chunk), 1, rec.f);
+	fwrite(&prev, sizeof(prev), 1, rec.f);
+	fwrite(rec.index, sizeof(uint64_t), rec.index_count, rec.f);
+	rec.offset += sizeof(chunk) + chunk.length;
+
+	rec.index_first += rec.index_count;
+	rec.index_count = 0;
+}
+
+bool record_start(const char *path, uint16_t width, uint16_t height) {
+	rec.f = fopen(path, "wb");
+	if(rec.f == NULL) {
+		fprintf(stderr, "Failed to open recording %s (%m)\n", path);
+		return false;
+	}
+	setvbuf(rec.f, rec.iobuf, _IOFBF, sizeof(rec.iobuf));
+
+	rec.pack = convert_find(PF_MONO10);
+	rec.width = width;
+	rec.height = height;
+	rec.frame_bytes = (size_t)width / 8 * height;
+	rec.start = prof_now();
+
+	struct RecordHeader header = {
+		.magic = RECORD_MAGIC,
+		.version = RECORD_VERSION,
+		.width = width,
+		.height = height,
+	};
+	fwrite(&header, sizeof(header), 1, rec.f);
+	rec.offset = sizeof(header);
+
+	printf("Recording to %s\n", path);
+	return true;
+}
+
+void record_frame(const uint8_t *canvas, uint32_t stride) {
+	if(rec.f == NULL) {
+		return;
+	}
+	uint64_t start = prof_now();
+
+	for(uint16_t y = 0; y < rec.height; y++) {
+		rec.pack->row(rec.cur + y * (rec.width / 8), canvas + y * stride, rec.width);
+	}
+
+	bool key = rec.frames % RECORD_KEYFRAME_INTERVAL == 0;
+	if(key) {
+		memcpy(rec.delta, rec.cur, rec.frame_bytes);
+	} else {
+		for(size_t i = 0; i < rec.frame_bytes; i++) {
+			rec.delta[i] = rec.cur[i] ^ rec.prev[i];
+		}
+	}
+	memcpy(rec.prev, rec.cur, rec.frame_bytes);
+
+	struct RecordChunk chunk = {
+		.type = 'F',
+		.flags = key ? RECORD_FLAG_KEY : 0,
+		.length = record_rle_encode(rec.payload, rec.delta, rec.frame_bytes),
+		.frame = rec.frames,
+		.time = start - rec.start,
+	};
+	rec.index[rec.index_count++] = rec.offset;
+	write_chunk(&chunk, rec.payload);
+	if(rec.index_count == RECORD_INDEX_FRAMES) {
+		flush_index();
+	}
+
+	rec.frames++;
+	rec.bytes += sizeof(chunk) + chunk.length;
+	uint64_t ns = prof_now() - start;
+	rec.encode_ns += ns;
+	if(ns > rec.encode_max) rec.encode_max = ns;
+}
+
+void record_stop(void) {
+	if(rec.f == NULL) {
+		return;
+	}
+
+	flush_index();
+	struct RecordFooter footer = {
+		.index = rec.last_index,
+		.magic = RECORD_INDEX_MAGIC,
+		.frames = rec.frames,
+	};
+	fwrite(&footer, sizeof(footer), 1, rec.f);
+	fclose(rec.f);
+	rec.f = NULL;
+
+	if(rec.frames > 0) {
+		printf(
+			"Recorded %u frames, %.1f bytes per frame, encode avg %.1f us max %.1f us\n",
+			rec.frames,
+			rec.bytes / (double)rec.frames,
+			rec.encode_ns / (double)rec.frames / 1e3,
+			rec.encode_max / 1e3
+		);
+	}
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Frame recorder, enabled by pointing FLIPPER_RECORD at a file. Frames are
+// packed to 1bpp, XORed against the previous frame and run length encoded,
+// which is cheap enough to leave on. flipplay turns a recording back into
+// images.
+//
+// File layout, all little endian:
+//   struct RecordHeader
+//   chunks, each a struct RecordChunk followed by length bytes of payload
+//     'F' frame: the RLE stream. Key frames are XORed against black
+//        instead of the previous frame, so playback can start there.
+//     'I' index: u64 offset of the previous index chunk (0 for none), then
+//        the u64 file offsets of the frames starting at chunk.frame
+//   struct RecordFooter, only if the recording was closed cleanly
+//
+// The RLE stream is a list of tokens. A token byte with the high bit set is
+// a run of (low 7 bits + 1) zero bytes, otherwise it's followed by
+// (token + 1) literal bytes.
+
+#define RECORD_MAGIC 0x52504c46 // "FLPR"
+#define RECORD_INDEX_MAGIC 0x58444946 // "FIDX"
+#define RECORD_VERSION 1
+#define RECORD_INDEX_FRAMES 256
+#define RECORD_KEYFRAME_INTERVAL 300
+
+#define RECORD_FLAG_KEY 0x01
+
+struct RecordHeader {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t width;
+	uint16_t height;
+	uint16_t reserved;
+};
+
+struct RecordChunk {
+	uint8_t type;
+	uint8_t flags;
+	uint16_t reserved;
+	uint32_t length;
+	uint32_t frame;
+	uint32_t reserved2;
+	// ns since the recording started
+	uint64_t time;
+};
+
+struct RecordFooter {
+	uint64_t index;
+	uint32_t magic;
+	uint32_t frames;
+};
+
+// Worst case a 1bpp frame grows by one token per 128 bytes
+#define RECORD_MAX_PAYLOAD(bytes) ((bytes) + (bytes) / 128 + 1)
+
+size_t record_rle_encode(uint8_t *restrict out, const uint8_t *restrict in, size_t len);
+// Returns false if the stream doesn't decode to exactly len bytes
+bool record_rle_decode(uint8_t *restrict out, size_t len, const uint8_t *restrict in, size_t in_len);
+
+// Frames of width x height, width a multiple of 8
+bool record_start(const char *path, uint16_t width, uint16_t height);
+void record_frame(const uint8_t *canvas, uint32_t stride);
+void record_stop(void);
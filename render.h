@@ -2,18 +2,25 @@
 
 #define SDL 1
 #define FB 2
+#define DRM 3
+#define SHM 4
+#define MLCD 5
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
 
 #if RENDER == SDL
 #include <SDL/SDL.h>
-#elif RENDER == FB
-#include <libevdev/libevdev.h>
 #endif
 
+// The canvas size the game was made for, and what backends without a mode
+// of their own draw unless FLIPPER_SIZE says otherwise. The canvas can be
+// any size up to MAX_WIDTH x MAX_HEIGHT, see draw_size().
 #define WIDTH 400
 #define HEIGHT 240
+#define MAX_WIDTH 1280
+#define MAX_HEIGHT 720
 
 enum KeyCode {
 	KC_LEFT,
@@ -29,16 +36,53 @@ struct RenderContext {
 	SDL_Surface *surface;
 #elif RENDER == FB
 	uint8_t *fbuffer;
-	struct libevdev *dev;
+	uint32_t fbstride;
+	size_t fbsize;
+	const struct Converter *convert;
+	struct input *input;
 	unsigned short prev_tty;
 	int ttyfd;
 	int fbfd;
+#elif RENDER == DRM
+	struct drm *drm;
+	struct input *input;
+#elif RENDER == SHM
+	struct ShmHeader *shm;
+	size_t shmsize;
+	uint32_t shmslot;
+	// key_changes as of the last pump()
+	uint32_t shmkeys;
+	int shmfd;
+	int listenfd;
+#elif RENDER == MLCD
+	struct mlcd *mlcd;
+	struct input *input;
 #endif
 	uint8_t keys[KC_LAST];
+	// Canvas size, picked by init_render()
+	uint16_t width;
+	uint16_t height;
 	uint8_t *buffer;
+	// Bytes from one canvas row to the next
+	uint32_t stride;
+	// Band mode, for backends that can take the frame a few rows at a time.
+	// buffer then only holds band_rows rows, starting at canvas row top,
+	// and band() gets every band as soon as it's drawn. The whole frame is
+	// never in memory. band_rows is 0 for a canvas of the whole frame.
+	uint16_t band_rows;
+	uint16_t top;
+	void (*band)(struct RenderContext *ctx, uint16_t y0, uint16_t y1);
+	// Set when render() waits for the display, so the frame loop doesn't
+	// have to sleep
+	bool vsync;
 };
 
 void init_render(struct RenderContext *ctx);
 bool pump(struct RenderContext *ctx);
 void render(struct RenderContext *ctx);
+// Sleep between frames for up to us microseconds, and wake as soon as a key
+// goes down or up. True if a key woke it. Every frame that isn't presented
+// comes here instead of render(), even with no time to sleep, so a display
+// that has to be kept going between frames is kept going here.
+bool wait_input(struct RenderContext *ctx, uint32_t us);
 void stop(struct RenderContext *ctx);
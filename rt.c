@@ -0,0 +1,76 @@
+#define _GNU_SOURCE
+#include "rt.h"
+#include "mem.h"
+#include "render.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+// Input runs above the frame loop so a key event is never stuck behind a
+// frame
+static const struct {
+	const char *name;
+	const char *cpu_env;
+	int priority;
+} roles[] = {
+	[RT_RENDER] = { "render", "FLIPPER_RT_CPU", 50 },
+	[RT_INPUT] = { "input", "FLIPPER_RT_INPUT_CPU", 60 },
+};
+
+bool rt_enabled(void) {
+	return getenv("FLIPPER_RT") != NULL;
+}
+
+void rt_start(void) {
+	if(!rt_enabled()) {
+		return;
+	}
+
+	// Room for the largest canvas, with a huge page to spare for the
+	// textures
+	if(mem_huge(MAX_WIDTH * MAX_HEIGHT * 4 + (2 << 20))) {
+		printf("Real-time: frame arena on reserved huge pages\n");
+	} else {
+		printf("Real-time: frame arena on transparent huge pages\n");
+	}
+	rt_thread(RT_RENDER);
+}
+
+void rt_thread(enum RtThread role) {
+	if(!rt_enabled()) {
+		return;
+	}
+
+	struct sched_param param = {
+		.sched_priority = roles[role].priority,
+	};
+	int rc = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+	if(rc != 0) {
+		fprintf(stderr, "Real-time: failed to set SCHED_FIFO for %s (%s)\n", roles[role].name, strerror(rc));
+	}
+
+	const char *cpu = getenv(roles[role].cpu_env);
+	if(cpu != NULL) {
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(atoi(cpu), &set);
+		rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+		if(rc != 0) {
+			fprintf(stderr, "Real-time: failed to pin %s to cpu %s (%s)\n", roles[role].name, cpu, strerror(rc));
+		}
+	}
+}
+
+void rt_lock(void) {
+	if(!rt_enabled()) {
+		return;
+	}
+
+	if(mlockall(MCL_CURRENT | MCL_FUTURE) < 0) {
+		perror("Real-time: mlockall");
+	}
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stdbool.h>
+
+// Opt-in real-time mode, enabled by setting FLIPPER_RT. The frame loop and
+// input threads get SCHED_FIFO and can be pinned to a core with
+// FLIPPER_RT_CPU and FLIPPER_RT_INPUT_CPU. The canvas and textures are
+// carved from a huge page arena, and once startup is done everything is
+// locked in memory.
+enum RtThread {
+	RT_RENDER,
+	RT_INPUT,
+};
+
+bool rt_enabled(void);
+// Call before init_render, so the backend's canvas lands in the arena
+void rt_start(void);
+// Apply the policy and affinity for the role to the calling thread
+void rt_thread(enum RtThread role);
+// Call once everything is allocated and faulted in
+void rt_lock(void);
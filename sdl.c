@@ -1,6 +1,9 @@
 #include "render.h"
+#include "draw.h"
+#include "mem.h"
 
 #include <assert.h>
+#include <stdio.h>
 #include <string.h>
 
 static int filter(const SDL_Event * event) {
@@ -9,10 +12,6 @@ static int filter(const SDL_Event * event) {
 }
 
 void init_render(struct RenderContext *ctx) {
-	_Bool ok;
-
-	ctx->buffer = malloc(WIDTH * HEIGHT * 4);
-
 	atexit(SDL_Quit);
 	if(SDL_Init(SDL_INIT_VIDEO) < 0)
 		assert(false);
@@ -21,39 +20,96 @@ void init_render(struct RenderContext *ctx) {
 	SDL_WM_SetCaption(name, name);
 	SDL_WM_SetIcon(NULL, NULL);
 
-	ok = SDL_SetVideoMode(WIDTH, HEIGHT, 24, SDL_HWSURFACE);
-	assert(ok);
+	// Ask for the canvas' own depth. ANYFORMAT keeps SDL from slipping a
+	// converting shadow surface in between if the display can't do that.
+	draw_size(ctx, MAX_WIDTH, MAX_HEIGHT, WIDTH, HEIGHT);
+	SDL_Surface *screen = SDL_SetVideoMode(ctx->width, ctx->height, 32, SDL_SWSURFACE | SDL_ANYFORMAT);
+	assert(screen != NULL);
 
-	ctx->surface = SDL_CreateRGBSurfaceFrom(
-		ctx->buffer,
-		WIDTH, HEIGHT,
-		32, WIDTH * 4,
-		0xff, 0xff << 8, 0xff << 16, 0
-	);
+	ctx->surface = NULL;
+	ctx->vsync = false;
+	if(screen->format->BytesPerPixel == 4) {
+		// Canvas pixels are all ones or all zeros in the color channels, so
+		// whatever the channel order is we get the same picture. Draw
+		// straight into the display surface.
+		if(SDL_MUSTLOCK(screen)) SDL_LockSurface(screen);
+		ctx->buffer = screen->pixels;
+		ctx->stride = screen->pitch;
+	} else {
+		fprintf(stderr, "Display is %ubpp, converting every frame\n", screen->format->BitsPerPixel);
+		ctx->buffer = mem_alloc(ctx->width * ctx->height * 4);
+		ctx->stride = ctx->width * 4;
+		ctx->surface = SDL_CreateRGBSurfaceFrom(
+			ctx->buffer,
+			ctx->width, ctx->height,
+			32, ctx->width * 4,
+			0xff, 0xff << 8, 0xff << 16, 0
+		);
+	}
 
 	SDL_SetEventFilter(filter);
 }
 
+static void read_keys(uint8_t keys[KC_LAST]) {
+	uint8_t *keystate = SDL_GetKeyState(NULL);
+	keys[KC_UP] = keystate[SDLK_UP];
+	keys[KC_LEFT] = keystate[SDLK_LEFT];
+	keys[KC_RIGHT] = keystate[SDLK_RIGHT];
+	keys[KC_ESC] = keystate[SDLK_ESCAPE];
+}
+
 bool pump(struct RenderContext *ctx) {
 	for(SDL_Event event; SDL_PollEvent(&event);)
 		if(event.type == SDL_QUIT)
 			return false;
 
-	uint8_t *keystate = SDL_GetKeyState(NULL);
-	ctx->keys[KC_UP] = keystate[SDLK_UP];
-	ctx->keys[KC_LEFT] = keystate[SDLK_LEFT];
-	ctx->keys[KC_RIGHT] = keystate[SDLK_RIGHT];
-	ctx->keys[KC_ESC] = keystate[SDLK_ESCAPE];
-
+	read_keys(ctx->keys);
 	return true;
 }
 
+// SDL 1 can't wait for an event with a timeout, so this looks at the keys
+// every few milliseconds. It's the desktop backend, that's close enough.
+#define WAIT_SLICE_MS 4
+bool wait_input(struct RenderContext *ctx, uint32_t us) {
+	uint32_t end = SDL_GetTicks() + (us + 999) / 1000;
+	for(;;) {
+		SDL_PumpEvents();
+		uint8_t keys[KC_LAST];
+		read_keys(keys);
+		SDL_Event event;
+		if(memcmp(keys, ctx->keys, sizeof(keys)) != 0 || SDL_PeepEvents(&event, 1, SDL_PEEKEVENT, SDL_QUITMASK) > 0) {
+			return true;
+		}
+		int32_t left = end - SDL_GetTicks();
+		if(left <= 0) {
+			return false;
+		}
+		SDL_Delay(left < WAIT_SLICE_MS ? left : WAIT_SLICE_MS);
+	}
+}
+
 void render(struct RenderContext *ctx) {
-    SDL_Surface * screen = SDL_GetVideoSurface();
-    if(SDL_BlitSurface(ctx->surface, NULL, screen, NULL) == 0) {
-        SDL_UpdateRect(screen, 0, 0, 0, 0);
+	SDL_Surface * screen = SDL_GetVideoSurface();
+	if(ctx->surface != NULL) {
+		if(SDL_BlitSurface(ctx->surface, NULL, screen, NULL) == 0) {
+			SDL_UpdateRect(screen, 0, 0, 0, 0);
+		}
+		return;
 	}
+
+	if(SDL_MUSTLOCK(screen)) SDL_UnlockSurface(screen);
+	SDL_UpdateRect(screen, 0, 0, 0, 0);
+	if(SDL_MUSTLOCK(screen)) SDL_LockSurface(screen);
+	// Locking is allowed to move the pixels
+	ctx->buffer = screen->pixels;
 }
 
 void stop(struct RenderContext *ctx) {
+	if(ctx->surface != NULL) {
+		SDL_FreeSurface(ctx->surface);
+		mem_free(ctx->buffer);
+	} else {
+		SDL_Surface *screen = SDL_GetVideoSurface();
+		if(SDL_MUSTLOCK(screen)) SDL_UnlockSurface(screen);
+	}
 }
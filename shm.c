@@ -0,0 +1,199 @@
+#define _GNU_SOURCE
+#include "render.h"
+#include "draw.h"
+#include "shm.h"
+#include "mem.h"
+#include "prof.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+
+static const char *socket_path(void) {
+	const char *path = getenv("FLIPPER_SHM");
+	return path != NULL ? path : SHM_SOCKET;
+}
+
+// A socket left behind by a producer that's gone is taken over. Anything
+// else at the path, a file that isn't a socket or one another producer is
+// listening on, is left alone, and bind() fails on it.
+static void remove_stale(const char *path, const struct sockaddr_un *addr) {
+	struct stat st;
+	if(lstat(path, &st) < 0 || !S_ISSOCK(st.st_mode)) {
+		return;
+	}
+	int probe = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if(probe < 0) {
+		return;
+	}
+	bool stale = connect(probe, (const struct sockaddr *)addr, sizeof(*addr)) < 0 && errno == ECONNREFUSED;
+	close(probe);
+	if(stale) {
+		unlink(path);
+	}
+}
+
+// Mark the slot as being drawn and point the canvas at it
+static void begin_slot(struct RenderContext *ctx, uint32_t slot) {
+	struct ShmHeader *h = ctx->shm;
+	ctx->shmslot = slot;
+	atomic_fetch_add_explicit(&h->slot[slot].seq, 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	ctx->buffer = shm_canvas(h, slot);
+}
+
+void init_render(struct RenderContext *ctx) {
+	size_t header = (sizeof(struct ShmHeader) + 63) & ~(size_t)63;
+	draw_size(ctx, MAX_WIDTH, MAX_HEIGHT, WIDTH, HEIGHT);
+	size_t slot_size = ctx->width * ctx->height * 4;
+	ctx->shmsize = header + SHM_SLOTS * slot_size;
+
+	ctx->shmfd = memfd_create("flipper", MFD_CLOEXEC);
+	if(ctx->shmfd < 0 || ftruncate(ctx->shmfd, ctx->shmsize) < 0) {
+		perror("Failed to create frame memfd");
+		exit(1);
+	}
+	struct ShmHeader *h = mmap(NULL, ctx->shmsize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ctx->shmfd, 0);
+	if(h == MAP_FAILED) {
+		perror("Failed to map frame memfd");
+		exit(1);
+	}
+	prefault(h, ctx->shmsize, true);
+	ctx->shm = h;
+
+	h->magic = SHM_MAGIC;
+	h->version = SHM_VERSION;
+	h->width = ctx->width;
+	h->height = ctx->height;
+	h->stride = ctx->width * 4;
+	h->slots = SHM_SLOTS;
+	h->offset = header;
+	h->slot_size = slot_size;
+	prof_phase("memfd");
+
+	const char *path = socket_path();
+	ctx->listenfd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	struct sockaddr_un addr = {
+		.sun_family = AF_UNIX,
+	};
+	snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+	remove_stale(path, &addr);
+	if(ctx->listenfd < 0
+			|| bind(ctx->listenfd, (struct sockaddr *)&addr, sizeof(addr)) < 0
+			|| listen(ctx->listenfd, 4) < 0) {
+		fprintf(stderr, "Failed to listen on %s (%m)\n", path);
+		exit(1);
+	}
+	printf("Publishing frames on %s\n", path);
+	prof_phase("socket");
+
+	ctx->stride = ctx->width * 4;
+	ctx->vsync = false;
+	memset(ctx->keys, 0, KC_LAST * sizeof(uint8_t));
+	begin_slot(ctx, 0);
+}
+
+// Hand the memfd to anyone who connected since the last frame
+static void accept_consumers(struct RenderContext *ctx) {
+	for(int fd; (fd = accept4(ctx->listenfd, NULL, NULL, SOCK_CLOEXEC)) >= 0;) {
+		char cmsg[CMSG_SPACE(sizeof(int))] = {0};
+		uint8_t version = SHM_VERSION;
+		struct iovec iov = {
+			.iov_base = &version,
+			.iov_len = sizeof(version),
+		};
+		struct msghdr msg = {
+			.msg_iov = &iov,
+			.msg_iovlen = 1,
+			.msg_control = cmsg,
+			.msg_controllen = sizeof(cmsg),
+		};
+		struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+		c->cmsg_level = SOL_SOCKET;
+		c->cmsg_type = SCM_RIGHTS;
+		c->cmsg_len = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(c), &ctx->shmfd, sizeof(int));
+
+		if(sendmsg(fd, &msg, MSG_NOSIGNAL) < 0) {
+			perror("Failed to send frame memfd");
+		} else {
+			printf("Consumer connected\n");
+		}
+		close(fd);
+	}
+}
+
+bool pump(struct RenderContext *ctx) {
+	struct ShmHeader *h = ctx->shm;
+	// Before anyone new can look at it
+	atomic_store_explicit(&h->alive, prof_now(), memory_order_relaxed);
+	accept_consumers(ctx);
+
+	ctx->shmkeys = atomic_load_explicit(&h->key_changes, memory_order_acquire);
+	for(uint8_t k = 0; k < KC_LAST; k++) {
+		ctx->keys[k] = atomic_load_explicit(&h->keys[k], memory_order_relaxed);
+	}
+	return true;
+}
+
+bool wait_input(struct RenderContext *ctx, uint32_t us) {
+	struct ShmHeader *h = ctx->shm;
+	uint64_t end = prof_now() + us * 1000ull;
+	for(uint64_t now; (now = prof_now()) < end;) {
+		if(atomic_load_explicit(&h->key_changes, memory_order_relaxed) != ctx->shmkeys) {
+			return true;
+		}
+		struct timespec timeout = {
+			.tv_sec = (end - now) / 1000000000,
+			.tv_nsec = (end - now) % 1000000000,
+		};
+		syscall(SYS_futex, &h->key_changes, FUTEX_WAIT, ctx->shmkeys, &timeout, NULL, 0);
+	}
+	return atomic_load_explicit(&h->key_changes, memory_order_relaxed) != ctx->shmkeys;
+}
+
+void render(struct RenderContext *ctx) {
+	struct ShmHeader *h = ctx->shm;
+	struct ShmSlot *s = &h->slot[ctx->shmslot];
+	uint32_t frame = atomic_load_explicit(&h->frame, memory_order_relaxed) + 1;
+
+	s->frame = frame;
+	s->published = prof_now();
+	atomic_store_explicit(&s->seq, atomic_load_explicit(&s->seq, memory_order_relaxed) + 1, memory_order_release);
+	atomic_store_explicit(&h->latest, ctx->shmslot, memory_order_release);
+	atomic_store_explicit(&h->frame, frame, memory_order_release);
+	syscall(SYS_futex, &h->frame, FUTEX_WAKE, INT32_MAX, NULL, NULL, 0);
+
+	// Nothing is done with the published frame on our side, go straight on
+	// to the next slot
+	begin_slot(ctx, (ctx->shmslot + 1) % SHM_SLOTS);
+}
+
+void stop(struct RenderContext *ctx) {
+	struct ShmHeader *h = ctx->shm;
+	uint32_t published = atomic_load(&h->frame);
+	uint32_t shown = atomic_load(&h->shown);
+	printf("Published %u frames, consumer showed %u (%u dropped)", published, shown, published - shown);
+	if(shown > 0) {
+		printf(
+			", publish to consumer avg %.3f ms max %.3f ms",
+			atomic_load(&h->latency_sum) / (double)shown / 1e6,
+			atomic_load(&h->latency_max) / 1e6
+		);
+	}
+	printf("\n");
+
+	close(ctx->listenfd);
+	unlink(socket_path());
+	munmap(h, ctx->shmsize);
+	close(ctx->shmfd);
+}
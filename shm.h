@@ -0,0 +1,64 @@
+#pragma once
+
+#include "render.h"
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+// Layout of the memfd shared between the SHM backend and whoever shows its
+// frames. The producer draws straight into one of the slots and publishes it
+// by bumping frame, which is also the futex consumers sleep on. Each slot
+// has a seqlock, odd while the producer is drawing into it, so a consumer
+// that was too slow to copy a frame out notices and retries with a newer
+// one.
+//
+// The producer stops publishing while its frames come out the same, see
+// idle.h. It still bumps alive every frame it draws, and sleeps on
+// key_changes in the meantime, which consumers bump and wake whenever a key
+// goes down or up.
+//
+// The fd is handed out over a unix socket (FLIPPER_SHM, default
+// /tmp/flipper.sock) with SCM_RIGHTS.
+
+#define SHM_MAGIC 0x464c4950
+#define SHM_VERSION 2
+#define SHM_SLOTS 3
+#define SHM_SOCKET "/tmp/flipper.sock"
+
+struct ShmSlot {
+	atomic_uint seq;
+	uint32_t frame;
+	// CLOCK_MONOTONIC ns when it was published
+	uint64_t published;
+};
+
+struct ShmHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint16_t width;
+	uint16_t height;
+	uint32_t stride;
+	uint32_t slots;
+	// Canvas i starts at offset + i * slot_size
+	uint32_t offset;
+	uint32_t slot_size;
+
+	// Producer side
+	atomic_uint frame;
+	atomic_uint latest;
+	struct ShmSlot slot[SHM_SLOTS];
+	// CLOCK_MONOTONIC ns of the last frame drawn, published or not
+	atomic_ullong alive;
+
+	// Consumer side. The keys go into ctx->keys, the rest are stats the
+	// producer reports.
+	atomic_uchar keys[KC_LAST];
+	atomic_uint key_changes;
+	atomic_uint shown;
+	atomic_ullong latency_sum;
+	atomic_ullong latency_max;
+};
+
+static inline uint8_t *shm_canvas(struct ShmHeader *h, uint32_t slot) {
+	return (uint8_t *)h + h->offset + slot * h->slot_size;
+}
@@ -0,0 +1,245 @@
+#include "shm.h"
+#include "convert.h"
+#include "prof.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+
+// Reference consumer for RENDER=SHM. Shows stats once a second and with -o
+// writes every frame it picks up as a PBM. When started on a terminal the
+// game keys (d, k, space, esc/q) are sent back to the producer.
+
+// Terminals don't report releases, so a key counts as held until the
+// autorepeat stops refreshing it
+#define KEY_HOLD_NS 150000000ull
+
+static struct termios saved_termios;
+static bool raw_terminal = false;
+
+static void restore_terminal(void) {
+	if(raw_terminal) {
+		tcsetattr(STDIN_FILENO, TCSANOW, &saved_termios);
+	}
+}
+
+static int receive_fd(const char *path) {
+	int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	struct sockaddr_un addr = {
+		.sun_family = AF_UNIX,
+	};
+	snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+	if(sock < 0 || connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		fprintf(stderr, "Failed to connect to %s (%m)\n", path);
+		exit(1);
+	}
+
+	char cmsg[CMSG_SPACE(sizeof(int))];
+	uint8_t version;
+	struct iovec iov = {
+		.iov_base = &version,
+		.iov_len = sizeof(version),
+	};
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = cmsg,
+		.msg_controllen = sizeof(cmsg),
+	};
+	if(recvmsg(sock, &msg, MSG_CMSG_CLOEXEC) < 0) {
+		perror("recvmsg");
+		exit(1);
+	}
+	close(sock);
+
+	struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+	if(c == NULL || c->cmsg_type != SCM_RIGHTS || version != SHM_VERSION) {
+		fprintf(stderr, "Producer didn't send a usable memfd\n");
+		exit(1);
+	}
+	int fd;
+	memcpy(&fd, CMSG_DATA(c), sizeof(int));
+	return fd;
+}
+
+static void update_keys(struct ShmHeader *h, uint64_t held[KC_LAST]) {
+	uint64_t now = prof_now();
+	char c;
+	while(raw_terminal && read(STDIN_FILENO, &c, 1) == 1) {
+		switch(c) {
+			case 'd':
+				held[KC_LEFT] = now;
+				break;
+			case 'k':
+				held[KC_RIGHT] = now;
+				break;
+			case ' ':
+				held[KC_UP] = now;
+				break;
+			case 'q':
+			case 27:
+				held[KC_ESC] = now;
+				break;
+		}
+	}
+
+	bool changed = false;
+	for(uint8_t k = 0; k < KC_LAST; k++) {
+		bool down = held[k] != 0 && now - held[k] < KEY_HOLD_NS;
+		changed |= atomic_exchange_explicit(&h->keys[k], down, memory_order_relaxed) != down;
+	}
+	// Wakes the producer if it's idling
+	if(changed) {
+		atomic_fetch_add_explicit(&h->key_changes, 1, memory_order_release);
+		syscall(SYS_futex, &h->key_changes, FUTEX_WAKE, INT32_MAX, NULL, NULL, 0);
+	}
+}
+
+static void write_pbm(const char *prefix, uint32_t frame, const uint8_t *canvas, uint16_t width, uint16_t height, uint32_t stride) {
+	// PBM is 1 for black with the leftmost pixel in the high bit
+	const struct Converter *c = convert_find(PF_MONO01);
+	uint8_t row[(width + 7) / 8];
+
+	char path[256];
+	snprintf(path, sizeof(path), "%s%06u.pbm", prefix, frame);
+	FILE *f = fopen(path, "wb");
+	if(f == NULL) {
+		fprintf(stderr, "Failed to write %s (%m)\n", path);
+		return;
+	}
+	fprintf(f, "P4\n%u %u\n", width, height);
+	for(uint16_t y = 0; y < height; y++) {
+		c->row(row, canvas + y * stride, width);
+		fwrite(row, 1, sizeof(row), f);
+	}
+	fclose(f);
+}
+
+int main(int argc, char *argv[]) {
+	const char *path = getenv("FLIPPER_SHM") != NULL ? getenv("FLIPPER_SHM") : SHM_SOCKET;
+	const char *prefix = NULL;
+	uint32_t limit = 0;
+
+	for(int opt; (opt = getopt(argc, argv, "s:o:n:")) != -1;) {
+		switch(opt) {
+			case 's':
+				path = optarg;
+				break;
+			case 'o':
+				prefix = optarg;
+				break;
+			case 'n':
+				limit = atoi(optarg);
+				break;
+			default:
+				fprintf(stderr, "Usage: %s [-s socket] [-o prefix] [-n frames]\n", argv[0]);
+				return 1;
+		}
+	}
+
+	int fd = receive_fd(path);
+	struct stat st;
+	fstat(fd, &st);
+	struct ShmHeader *h = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if(h == MAP_FAILED || h->magic != SHM_MAGIC) {
+		fprintf(stderr, "Not a flipper frame memfd\n");
+		return 1;
+	}
+	printf("Connected: %ux%u, %u slots\n", h->width, h->height, h->slots);
+
+	if(isatty(STDIN_FILENO) && tcgetattr(STDIN_FILENO, &saved_termios) == 0) {
+		struct termios raw = saved_termios;
+		raw.c_lflag &= ~(ICANON | ECHO);
+		tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+		fcntl(STDIN_FILENO, F_SETFL, fcntl(STDIN_FILENO, F_GETFL) | O_NONBLOCK);
+		raw_terminal = true;
+		atexit(restore_terminal);
+	}
+
+	uint8_t *canvas = malloc(h->slot_size);
+	uint64_t held[KC_LAST] = {0};
+	// Start from the frame that's out already, it's all there is while the
+	// producer idles
+	uint32_t seen = atomic_load(&h->frame);
+	if(seen > 0) {
+		seen--;
+	}
+	uint32_t shown = 0;
+	uint32_t retries = 0;
+	uint64_t last_report = prof_now();
+	uint32_t last_shown = 0;
+
+	while(limit == 0 || shown < limit) {
+		struct timespec timeout = {
+			.tv_sec = 0,
+			.tv_nsec = 20000000,
+		};
+		syscall(SYS_futex, &h->frame, FUTEX_WAIT, seen, &timeout, NULL, 0);
+		update_keys(h, held);
+
+		uint64_t now = prof_now();
+		if(now - last_report > 1000000000ull) {
+			printf("%u fps, %u frames published, %u torn reads\n", shown - last_shown, atomic_load(&h->frame), retries);
+			last_shown = shown;
+			last_report = now;
+		}
+
+		uint32_t frame = atomic_load_explicit(&h->frame, memory_order_acquire);
+		if(frame == seen) {
+			// The producer went away
+			if(now - atomic_load_explicit(&h->alive, memory_order_relaxed) > 2000000000ull) {
+				break;
+			}
+			continue;
+		}
+
+		// Copy the latest frame out, and try again if the producer started
+		// drawing over it while we were at it
+		struct ShmSlot *s;
+		uint32_t number;
+		uint64_t published;
+		for(;;) {
+			s = &h->slot[atomic_load_explicit(&h->latest, memory_order_acquire)];
+			uint32_t seq = atomic_load_explicit(&s->seq, memory_order_acquire);
+			if(seq & 1) {
+				retries++;
+				continue;
+			}
+			memcpy(canvas, shm_canvas(h, s - h->slot), h->slot_size);
+			number = s->frame;
+			published = s->published;
+			atomic_thread_fence(memory_order_acquire);
+			if(atomic_load_explicit(&s->seq, memory_order_relaxed) == seq) {
+				break;
+			}
+			retries++;
+		}
+		seen = frame;
+		shown++;
+
+		uint64_t latency = prof_now() - published;
+		atomic_fetch_add(&h->shown, 1);
+		atomic_fetch_add(&h->latency_sum, latency);
+		unsigned long long max = atomic_load(&h->latency_max);
+		while(latency > max && !atomic_compare_exchange_weak(&h->latency_max, &max, latency));
+
+		if(prefix != NULL) {
+			write_pbm(prefix, number, canvas, h->width, h->height, h->stride);
+		}
+	}
+
+	free(canvas);
+	munmap(h, st.st_size);
+	close(fd);
+	return 0;
+}
@@ -0,0 +1,269 @@
+#include "sim.h"
+#include "game.h"
+
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The step is written without branches: both sides of every if are worked
+// out and the result picked, which is what lets it vectorize. The
+// arithmetic of each side is exactly what process() used to do, in the same
+// order and precision, so the results stay the same to the bit.
+
+// fminf() and fmaxf() without the NaN rules, which keep them from being
+// vectorized. Nothing here is NaN, and the rest is the same.
+static inline float minf(float a, float b) {
+	return a < b ? a : b;
+}
+
+static inline float maxf(float a, float b) {
+	return a > b ? a : b;
+}
+
+static inline float clamp(float min, float max, float t) {
+	return maxf(minf(t, max), min);
+}
+
+// roundf(), halfway cases away from zero, out of truncf() which vectorizes.
+// v - truncf(v) is exact for every float.
+static inline float round_away(float v) {
+	float r = truncf(v);
+	return fabsf(v - r) >= 0.5f ? r + copysignf(1.0f, v) : r;
+}
+
+static inline uint32_t bits(float v) {
+	uint32_t u;
+	memcpy(&u, &v, sizeof(u));
+	return u;
+}
+
+#define ALIGN 64
+
+// Every field in order, with its element size, so allocating and resetting
+// don't have to list them again
+#define FIELDS(F) \
+	F(angle) F(dirx) F(diry) F(x) F(y) F(velx) F(vely) F(inWater) F(lastUp) \
+	F(floor) F(bend) F(wiggleT) F(wiggle) F(splashed) F(splashX) F(splashScale) \
+	F(splashEscale) F(splashLife)
+
+static size_t field_bytes(size_t size, uint32_t count) {
+	return (size * count + ALIGN - 1) / ALIGN * ALIGN;
+}
+
+bool sim_alloc(struct SimBatch *b, uint32_t count) {
+	size_t len = 0;
+#define SIZE(f) len += field_bytes(sizeof(*b->f), count);
+	FIELDS(SIZE)
+#undef SIZE
+	uint8_t *p = aligned_alloc(ALIGN, len > 0 ? len : ALIGN);
+	if(p == NULL) {
+		return false;
+	}
+	b->count = count;
+#define CARVE(f) b->f = (void *)p; p += field_bytes(sizeof(*b->f), count);
+	FIELDS(CARVE)
+#undef CARVE
+	sim_reset(b);
+	return true;
+}
+
+void sim_free(struct SimBatch *b) {
+	free(b->angle);
+	memset(b, 0, sizeof(*b));
+}
+
+void sim_reset(struct SimBatch *b) {
+#define ZERO(f) memset(b->f, 0, sizeof(*b->f) * b->count);
+	FIELDS(ZERO)
+#undef ZERO
+	for(uint32_t i = 0; i < b->count; i++) {
+		b->y[i] = 100;
+		b->floor[i] = -500;
+		b->dirx[i] = cosf(0.0f);
+		b->diry[i] = sinf(0.0f);
+	}
+}
+
+// Turning. Says which dolphins' heading changed, their direction has to be
+// worked out again.
+static void steer(struct SimBatch *b, uint32_t first, uint32_t n, const uint8_t *input, uint8_t *turned) {
+	float *angles = b->angle + first, *bends = b->bend + first;
+	const float *dirx = b->dirx + first, *diry = b->diry + first;
+	const float *velx = b->velx + first, *vely = b->vely + first;
+	// The fields never overlap
+#pragma GCC ivdep
+	for(uint32_t i = 0; i < n; i++) {
+		float dot = dirx[i] * (velx[i]) + diry[i] * (vely[i]);
+		float dir = dot > 0.0 ? 1 : -1;
+
+		float angle = angles[i], bend = bends[i];
+		float leftAngle = angle + .04, leftBend = bend + dir * 0.15;
+		float rightAngle = angle - .04, rightBend = bend - dir * 0.15;
+		// Straightening stops at straight instead of going past it, which
+		// would flick the tail from side to side for ever
+		float straightBend = fabsf(bend) <= 0.1f ? 0.0f : bend - (bend > 0.0 ? 1 : -1) * 0.1;
+		bool left = input[i] & SIM_LEFT, right = input[i] & SIM_RIGHT;
+		float newAngle = left ? leftAngle : right ? rightAngle : angle;
+		bend = left ? leftBend : right ? rightBend : straightBend;
+
+		newAngle = newAngle < 0.0 ? newAngle + M_PI*2 : newAngle;
+		newAngle = newAngle > 0.0 ? newAngle - M_PI*2 : newAngle;
+		bends[i] = clamp(-1.0, 1.0, bend);
+		turned[i] = bits(newAngle) != bits(angle);
+		angles[i] = newAngle;
+	}
+}
+
+// The only libm calls, which don't vectorize. The heading only changes
+// while turning, the rest of the time last step's direction still holds.
+static void direction(struct SimBatch *b, uint32_t first, uint32_t n, const uint8_t *turned) {
+	for(uint32_t i = 0; i < n; i++) {
+		if(turned[i]) {
+			b->dirx[first + i] = cosf(b->angle[first + i]);
+			b->diry[first + i] = sinf(b->angle[first + i]);
+		}
+	}
+}
+
+// Splashes, gravity, drag, kicking and moving
+static void move(struct SimBatch *b, uint32_t first, uint32_t n, const uint8_t *input) {
+	const float *dirx = b->dirx + first, *diry = b->diry + first;
+	float *velxs = b->velx + first, *velys = b->vely + first;
+	int32_t *xs = b->x + first, *ys = b->y + first;
+	uint8_t *inWaters = b->inWater + first, *lastUps = b->lastUp + first;
+	const int32_t *floors = b->floor + first;
+	float *wiggleTs = b->wiggleT + first, *wiggles = b->wiggle + first;
+	uint8_t *splasheds = b->splashed + first;
+	int32_t *splashXs = b->splashX + first;
+	uint8_t *splashScales = b->splashScale + first, *splashEscales = b->splashEscale + first, *splashLifes = b->splashLife + first;
+#pragma GCC ivdep
+	for(uint32_t i = 0; i < n; i++) {
+		float dx = dirx[i], dy = diry[i];
+		float velx = velxs[i], vely = velys[i];
+		int32_t x = xs[i], y = ys[i];
+		uint8_t inWater = inWaters[i];
+
+		uint8_t splashed = inWater ^ (y <= 0);
+		float dot = -dy * (velx) + dx * (vely);
+		uint8_t scale = minf(fabsf(dot) * 64, 255.0);
+		float pdot = dx * (velx) + dy * (vely);
+		uint8_t escale = inWater ? 0 : minf(fabsf(pdot) * 64, 255.0);
+		splasheds[i] = splashed;
+		splashXs[i] = splashed ? x : splashXs[i];
+		splashScales[i] = splashed ? scale : splashScales[i];
+		splashLifes[i] = splashed ? (uint8_t)lerpf(30, 60, scale/255.0) : splashLifes[i];
+		splashEscales[i] = splashed ? escale : splashEscales[i];
+		inWater = y <= 0;
+
+		// Gravity over water
+		float fallVely = vely - 0.05;
+
+		// Drag under water
+		float dragVelx = velx * .99999f, dragVely = vely * .99999f;
+		bool moving = fabsf(dragVelx) > 0.00001f || fabsf(dragVely) > 0.00001f;
+		float dragDot = -dy * (dragVelx) + dx * (dragVely);
+		// There's some layer of less heavy water near the surface
+		float depth_factor = clamp(0.0f, 1.0f, -y / 50.0f);
+		depth_factor *= depth_factor;
+		float liftVelx = dragVelx + -dy * -dragDot * .3f * depth_factor;
+		float liftVely = dragVely +  dx * -dragDot * .3f * depth_factor;
+
+		velx = inWater ? (moving ? liftVelx : dragVelx) : velx;
+		vely = inWater ? (moving ? liftVely : dragVely) : fallVely;
+
+		bool up = input[i] & SIM_UP;
+		bool kick = up && !lastUps[i] && inWater;
+		velx = kick ? velx + dx * 1.0f : velx;
+		vely = kick ? vely + dy * 1.0f : vely;
+		float wiggleT = kick ? 60.0f : wiggleTs[i];
+		lastUps[i] = up;
+
+		x += round_away(velx);
+		y += round_away(vely);
+		bool bottom = y < floors[i];
+		vely = bottom ? 0 : vely;
+		y = bottom ? floors[i] : y;
+
+		bool wiggling = wiggleT > 0.0;
+		wiggleTs[i] = wiggling ? wiggleT - 1.0 : wiggleT;
+		wiggles[i] = wiggling ? wiggles[i] + M_PI/15.0 : 0.0;
+
+		velxs[i] = velx;
+		velys[i] = vely;
+		xs[i] = x;
+		ys[i] = y;
+		inWaters[i] = inWater;
+	}
+}
+
+void sim_step(struct SimBatch *b, uint32_t first, uint32_t last, const uint8_t *input) {
+	uint8_t turned[SIM_BLOCK];
+	for(uint32_t block = first; block < last; block += SIM_BLOCK) {
+		uint32_t n = last - block < SIM_BLOCK ? last - block : SIM_BLOCK;
+		const uint8_t *in = input + (block - first);
+		steer(b, block, n, in, turned);
+		direction(b, block, n, turned);
+		move(b, block, n, in);
+	}
+}
+
+struct Job {
+	struct SimBatch *b;
+	const uint8_t *inputs;
+	size_t stride;
+	uint32_t steps;
+	uint32_t first;
+	uint32_t last;
+};
+
+// A block at a time through every step, so its fields stay in cache
+static void *run(void *arg) {
+	const struct Job *job = arg;
+	uint8_t input[SIM_BLOCK];
+	for(uint32_t block = job->first; block < job->last; block += SIM_BLOCK) {
+		uint32_t end = job->last - block < SIM_BLOCK ? job->last : block + SIM_BLOCK;
+		for(uint32_t s = 0; s < job->steps; s++) {
+			for(uint32_t i = block; i < end; i++) {
+				input[i - block] = job->inputs[i * job->stride + s];
+			}
+			sim_step(job->b, block, end, input);
+		}
+	}
+	return NULL;
+}
+
+void sim_run(struct SimBatch *b, const uint8_t *inputs, size_t stride, uint32_t steps, uint8_t threads) {
+	// Whole blocks per thread, and no threads without a block to do
+	uint32_t blocks = (b->count + SIM_BLOCK - 1) / SIM_BLOCK;
+	if(threads > blocks) threads = blocks;
+	if(threads < 1) threads = 1;
+
+	struct Job jobs[threads];
+	pthread_t tids[threads];
+	bool threaded[threads];
+	for(uint8_t t = 0; t < threads; t++) {
+		uint32_t first = blocks * t / threads * SIM_BLOCK, last = blocks * (t + 1) / threads * SIM_BLOCK;
+		jobs[t] = (struct Job){
+			.b = b,
+			.inputs = inputs,
+			.stride = stride,
+			.steps = steps,
+			.first = first,
+			.last = last < b->count ? last : b->count,
+		};
+		// The first job is ours, and so is any a thread couldn't be made
+		// for
+		threaded[t] = t > 0 && pthread_create(&tids[t], NULL, run, &jobs[t]) == 0;
+	}
+	for(uint8_t t = 0; t < threads; t++) {
+		if(!threaded[t]) {
+			run(&jobs[t]);
+		}
+	}
+	for(uint8_t t = 1; t < threads; t++) {
+		if(threaded[t]) {
+			pthread_join(tids[t], NULL);
+		}
+	}
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// The dolphin's physics without any drawing, for a batch of dolphins at
+// once: tuning the constants over thousands of runs, or bots. The batch is
+// a struct of arrays, dolphin i being index i of every field, and a step
+// goes over it a field at a time so the compiler can vectorize it.
+//
+// process() steps the player as a batch of one through the same code, so a
+// dolphin in a batch follows exactly the path the player would with the
+// same input, to the bit.
+
+// Input bits of one dolphin for one step
+#define SIM_LEFT 0x1
+#define SIM_RIGHT 0x2
+#define SIM_UP 0x4
+
+// Dolphins a thread steps together through all steps of sim_run(), small
+// enough for all of their fields to stay in L1
+#define SIM_BLOCK 256
+
+struct SimBatch {
+	uint32_t count;
+
+	// Heading, and its cosine and sine
+	float *angle;
+	float *dirx;
+	float *diry;
+
+	int32_t *x;
+	int32_t *y;
+	float *velx;
+	float *vely;
+	uint8_t *inWater;
+	// Whether up was held the step before, a kick is only on the press
+	uint8_t *lastUp;
+	// The lowest y it can go to, the seabed under it. Left alone by the
+	// step, whoever knows the seabed sets it.
+	int32_t *floor;
+
+	float *bend;
+	float *wiggleT;
+	float *wiggle;
+
+	// Going in or out of the water starts a splash, splashed says whether
+	// that happened this step. The rest is only set when it did.
+	uint8_t *splashed;
+	int32_t *splashX;
+	uint8_t *splashScale;
+	uint8_t *splashEscale;
+	uint8_t *splashLife;
+};
+
+// The fields for count dolphins, in one allocation that sim_free() gives
+// back. False if there's no memory for it.
+bool sim_alloc(struct SimBatch *b, uint32_t count);
+void sim_free(struct SimBatch *b);
+// Every dolphin where the game starts the player, over a flat seabed
+void sim_reset(struct SimBatch *b);
+
+// One step of dolphins first to last - 1, with input[i - first] the input
+// of dolphin i
+void sim_step(struct SimBatch *b, uint32_t first, uint32_t last, const uint8_t *input);
+// steps steps of every dolphin, with inputs[i * stride + s] the input of
+// dolphin i for step s. The batch is split over up to threads threads.
+void sim_run(struct SimBatch *b, const uint8_t *inputs, size_t stride, uint32_t steps, uint8_t threads);
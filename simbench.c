@@ -0,0 +1,95 @@
+#include "bench.h"
+#include "sim.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// Throughput of the headless physics in dolphin steps per second, for
+// batches of different sizes on one thread and on every core. "alone" steps
+// every dolphin as a batch of one, the way process() steps the player, which
+// is what a batch is up against.
+
+#define STEPS 600
+
+struct Job {
+	struct SimBatch batch;
+	const uint8_t *inputs;
+	uint8_t threads;
+	bool alone;
+};
+
+static void run(void *arg) {
+	struct Job *job = arg;
+	sim_reset(&job->batch);
+	if(!job->alone) {
+		sim_run(&job->batch, job->inputs, STEPS, STEPS, job->threads);
+		return;
+	}
+	struct SimBatch one = job->batch;
+	one.count = 1;
+	for(uint32_t i = 0; i < job->batch.count; i++) {
+		for(uint32_t s = 0; s < STEPS; s++) {
+			sim_step(&one, 0, 1, &job->inputs[i * STEPS + s]);
+		}
+		// The next dolphin's fields
+		one.angle++; one.dirx++; one.diry++; one.x++; one.y++;
+		one.velx++; one.vely++; one.inWater++; one.lastUp++; one.floor++;
+		one.bend++; one.wiggleT++; one.wiggle++;
+		one.splashed++; one.splashX++; one.splashScale++; one.splashEscale++; one.splashLife++;
+	}
+}
+
+int main(int argc, char *argv[]) {
+	static const uint32_t counts[] = { 1, 64, 1024, 16384, 65536 };
+	const uint32_t most = counts[sizeof(counts) / sizeof(counts[0]) - 1];
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	uint8_t threads = cores < 1 ? 1 : cores > 64 ? 64 : cores;
+
+	// Held keys that change now and then, like a player or a bot
+	static const uint8_t moves[] = { 0, SIM_LEFT, SIM_RIGHT, SIM_UP, SIM_LEFT | SIM_UP, SIM_RIGHT | SIM_UP };
+	uint8_t *inputs = malloc((size_t)most * STEPS);
+	srand(1);
+	for(uint32_t i = 0; i < most; i++) {
+		uint8_t move = 0;
+		for(uint32_t s = 0; s < STEPS; s++) {
+			if(rand() % 16 == 0) {
+				move = moves[rand() % sizeof(moves)];
+			}
+			inputs[i * STEPS + s] = move;
+		}
+	}
+
+	printf("%-8s %8s %8s %14s %10s\n", "mode", "dolphins", "threads", "steps/s", "ns/step");
+	for(size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+		struct Job job = { .inputs = inputs };
+		if(!sim_alloc(&job.batch, counts[c])) {
+			fprintf(stderr, "Failed to allocate %u dolphins\n", counts[c]);
+			return 1;
+		}
+		const struct {
+			const char *name;
+			bool alone;
+			uint8_t threads;
+		} modes[] = {
+			{ "alone", true, 1 },
+			{ "batch", false, 1 },
+			{ "batch", false, threads },
+		};
+		for(size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+			if(m == 2 && threads == 1) {
+				continue;
+			}
+			job.alone = modes[m].alone;
+			job.threads = modes[m].threads;
+			// About the same number of steps for every size
+			uint32_t reps = 2000000 / ((uint64_t)counts[c] * STEPS) + 3;
+			struct BenchResult r = bench_run(run, &job, 1, reps);
+			double steps = (double)counts[c] * STEPS;
+			printf("%-8s %8u %8u %14.0f %10.2f\n", modes[m].name, counts[c], job.threads, steps / r.mean_ns * 1e9, r.mean_ns / steps);
+		}
+		sim_free(&job.batch);
+	}
+	free(inputs);
+	return 0;
+}
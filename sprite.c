@@ -0,0 +1,187 @@
+#include "sprite.h"
+#include "prof.h"
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+
+static struct Sprite slots[SPRITE_SLOTS];
+static uint8_t nslots;
+static uint32_t lookups;
+
+static struct {
+	uint32_t hits;
+	uint32_t misses;
+	uint32_t evictions;
+	uint32_t too_big;
+} stats;
+
+// Tiles draw in parallel, so every thread that blits counts on a cache line
+// of its own and sprite_report() adds them up. The tile workers and the
+// frame loop are at most 17 threads.
+#define BLIT_THREADS 32
+// Only one blit in this many is timed, reading the clock twice costs a
+// good part of a small one
+#define BLIT_SAMPLE 16
+
+static struct BlitStats {
+	uint32_t blits;
+	// Of those, the ones clip left nothing of
+	uint32_t clipped;
+	uint32_t timed;
+	uint64_t ns;
+} __attribute__((aligned(64))) blitStats[BLIT_THREADS];
+static atomic_uint blitThreads;
+static __thread struct BlitStats *threadBlits;
+
+static struct BlitStats *blit_stats(void) {
+	if(threadBlits == NULL) {
+		unsigned n = atomic_fetch_add_explicit(&blitThreads, 1, memory_order_relaxed);
+		threadBlits = &blitStats[n < BLIT_THREADS ? n : BLIT_THREADS - 1];
+	}
+	return threadBlits;
+}
+
+bool sprite_key_line(struct SpriteKey *key, uint16_t ax, uint16_t ay, uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1) {
+	int32_t d[4] = { x0 - ax, y0 - ay, x1 - ax, y1 - ay };
+	if(key->count >= SPRITE_LINES) {
+		return false;
+	}
+	for(uint8_t i = 0; i < 4; i++) {
+		if(d[i] < INT8_MIN || d[i] > INT8_MAX) {
+			return false;
+		}
+	}
+	key->lines[key->count++] = (struct SpriteLine){ d[0], d[1], d[2], d[3] };
+	return true;
+}
+
+static void setBit(void *arg, uint16_t x, uint16_t y) {
+	struct Sprite *s = arg;
+	s->rows[y] |= 1ull << x;
+}
+
+static bool rasterize(struct Sprite *s, const struct SpriteKey *key) {
+	int16_t left = INT16_MAX, top = INT16_MAX, right = INT16_MIN, bottom = INT16_MIN;
+	for(uint8_t i = 0; i < key->count; i++) {
+		const struct SpriteLine *l = &key->lines[i];
+		int16_t lx = l->x0 < l->x1 ? l->x0 : l->x1, hx = l->x0 < l->x1 ? l->x1 : l->x0;
+		int16_t ly = l->y0 < l->y1 ? l->y0 : l->y1, hy = l->y0 < l->y1 ? l->y1 : l->y0;
+		if(lx < left) left = lx;
+		if(hx > right) right = hx;
+		if(ly < top) top = ly;
+		if(hy > bottom) bottom = hy;
+	}
+	if(right - left >= SPRITE_SIZE || bottom - top >= SPRITE_SIZE) {
+		return false;
+	}
+
+	s->key = *key;
+	s->x = left;
+	s->y = top;
+	s->width = right - left + 1;
+	s->height = bottom - top + 1;
+	memset(s->rows, 0, sizeof(s->rows));
+	// Bresenham doesn't care where the line is, only how long and which
+	// way, so the line moved into the bitmap hits the same pixels
+	for(uint8_t i = 0; i < key->count; i++) {
+		const struct SpriteLine *l = &key->lines[i];
+		line_walk(l->x0 - left, l->y0 - top, l->x1 - left, l->y1 - top, key->fill, setBit, s);
+	}
+	return true;
+}
+
+const struct Sprite *sprite_get(const struct SpriteKey *key) {
+	lookups++;
+	struct Sprite *lru = &slots[0];
+	for(uint8_t i = 0; i < nslots; i++) {
+		struct Sprite *s = &slots[i];
+		if(s->key.count == key->count && s->key.fill == key->fill && memcmp(s->key.lines, key->lines, key->count * sizeof(struct SpriteLine)) == 0) {
+			s->used = lookups;
+			stats.hits++;
+			return s;
+		}
+		if(s->used < lru->used) {
+			lru = s;
+		}
+	}
+
+	struct Sprite *s = lru;
+	if(nslots < SPRITE_SLOTS) {
+		s = &slots[nslots];
+	} else {
+		stats.evictions++;
+	}
+	if(!rasterize(s, key)) {
+		stats.too_big++;
+		return NULL;
+	}
+	if(s == &slots[nslots]) {
+		nslots++;
+	}
+	s->used = lookups;
+	stats.misses++;
+	return s;
+}
+
+void sprite_blit(struct RenderContext *ctx, const struct Sprite *sprite, uint16_t x, uint16_t y, uint8_t v, const struct Rect *clip) {
+	struct BlitStats *bs = blit_stats();
+	bool timed = bs->blits++ % BLIT_SAMPLE == 0;
+	uint64_t start = timed ? prof_now() : 0;
+	int32_t left = x + sprite->x, top = y + sprite->y;
+	int32_t x0 = left > clip->x0 ? left : clip->x0;
+	int32_t x1 = left + sprite->width < clip->x1 ? left + sprite->width : clip->x1;
+	int32_t y0 = top > clip->y0 ? top : clip->y0;
+	int32_t y1 = top + sprite->height < clip->y1 ? top + sprite->height : clip->y1;
+	if(x0 >= x1 || y0 >= y1) {
+		bs->clipped++;
+		return;
+	}
+
+	// The bits of the columns inside clip
+	uint8_t lo = x0 - left, hi = x1 - left;
+	uint64_t mask = (hi == 64 ? ~0ull : (1ull << hi) - 1) & ~((1ull << lo) - 1);
+
+	// What plot() writes, as one word
+	const uint8_t px[4] = { v ? 255 : 0, v ? 255 : 0, v ? 255 : 0, 255 };
+	uint32_t word;
+	memcpy(&word, px, sizeof(word));
+
+	// One store per set bit. Writing runs of set bits as spans was tried and
+	// is about twice as slow: the lines are thin and mostly steep, so nearly
+	// every run is a pixel long and finding where it ends is the extra work.
+	for(int32_t sy = y0; sy < y1; sy++) {
+		uint64_t bits = sprite->rows[sy - top] & mask;
+		uint8_t *row = ctx->buffer + (sy - ctx->top) * ctx->stride;
+		while(bits != 0) {
+			int32_t sx = left + __builtin_ctzll(bits);
+			memcpy(row + sx * 4, &word, sizeof(word));
+			bits &= bits - 1;
+		}
+	}
+
+	if(timed) {
+		bs->timed++;
+		bs->ns += prof_now() - start;
+	}
+}
+
+void sprite_report(void) {
+	uint32_t total = stats.hits + stats.misses + stats.too_big;
+	if(total == 0) {
+		return;
+	}
+	// The tile workers are stopped by now
+	struct BlitStats sum = {0};
+	for(unsigned i = 0; i < BLIT_THREADS; i++) {
+		sum.blits += blitStats[i].blits;
+		sum.clipped += blitStats[i].clipped;
+		sum.timed += blitStats[i].timed;
+		sum.ns += blitStats[i].ns;
+	}
+	printf(
+		"Sprites: %u total, %.1f%% hits, %u rasterized (%u evicted, %u too big), %u in cache, %u blits (%u clipped away), blit avg %.0f ns\n",
+		total, 100.0 * stats.hits / total, stats.misses, stats.evictions, stats.too_big, nslots,
+		sum.blits, sum.clipped, sum.timed ? sum.ns / (double)sum.timed : 0.0
+	);
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "draw.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Cache of small line drawings rasterized to 1bpp, for overlays that look
+// much the same frame after frame, like the dolphin. A drawing is keyed by
+// its lines relative to an anchor point, so it's only rasterized again when
+// an endpoint moves by a pixel, and a blit sets exactly the pixels the lines
+// would have. The color is picked when blitting, so one bitmap serves both
+// colors. Once all SPRITE_SLOTS are taken the least recently used one is
+// rasterized over.
+
+#define SPRITE_LINES 4
+// Widest and tallest a sprite can be, a row of it is one uint64_t
+#define SPRITE_SIZE 64
+// A sprite is about 550 bytes, so this caps the cache at about 35 KB
+#define SPRITE_SLOTS 64
+
+struct SpriteLine {
+	int8_t x0;
+	int8_t y0;
+	int8_t x1;
+	int8_t y1;
+};
+
+struct SpriteKey {
+	uint8_t count;
+	uint8_t fill;
+	struct SpriteLine lines[SPRITE_LINES];
+};
+
+struct Sprite {
+	struct SpriteKey key;
+	// Top left corner of the bitmap from the anchor, and its size
+	int8_t x;
+	int8_t y;
+	uint8_t width;
+	uint8_t height;
+	// Lookup it was last handed out for
+	uint32_t used;
+	// Leftmost pixel in the lowest bit
+	uint64_t rows[SPRITE_SIZE];
+};
+
+// Add a line from (x0, y0) to (x1, y1) to the key, relative to the anchor
+// (ax, ay). False if it's too far from the anchor or the key is full, then
+// the drawing has to be drawn as lines.
+bool sprite_key_line(struct SpriteKey *key, uint16_t ax, uint16_t ay, uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1);
+// The sprite for the key, rasterized if it isn't cached. NULL if the lines
+// don't fit into SPRITE_SIZE.
+const struct Sprite *sprite_get(const struct SpriteKey *key);
+// Draw the sprite anchored at (x, y), only where it overlaps clip
+void sprite_blit(struct RenderContext *ctx, const struct Sprite *sprite, uint16_t x, uint16_t y, uint8_t v, const struct Rect *clip);
+
+// Hit rate and blit time so far
+void sprite_report(void);
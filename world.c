@@ -0,0 +1,353 @@
+#include "world.h"
+#include "game.h"
+#include "prof.h"
+#include "render.h"
+
+#include <assert.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+// Chunks a frame can see, for the widest canvas starting anywhere in a chunk
+#define VIEW_CHUNKS (MAX_WIDTH / CHUNK_WIDTH + 2)
+// Chunks made ahead of the frame's in the direction the dolphin is going:
+// always this many, and as many more as it covers in PREFETCH_STEPS steps,
+// up to PREFETCH_MAX. Behind it only one.
+#define PREFETCH_CHUNKS 2
+#define PREFETCH_STEPS 120
+#define PREFETCH_MAX 8
+
+static_assert(CHUNK_SLOTS >= 2 * (VIEW_CHUNKS + PREFETCH_MAX + 1), "a frame's chunks and the ones wanted ahead must fit at once");
+
+static uint32_t mix(uint32_t h) {
+	h ^= h >> 16;
+	h *= 0x7feb352d;
+	h ^= h >> 15;
+	h *= 0x846ca68b;
+	h ^= h >> 16;
+	return h;
+}
+
+static uint32_t hash2(uint32_t seed, int32_t i) {
+	return mix(seed * 0x9e3779b9u ^ mix(i));
+}
+
+static int32_t floordiv(int32_t x, int32_t d) {
+	return x >= 0 ? x / d : -((-x + d - 1) / d);
+}
+
+// Value noise in [0, 1] with a lattice point every period columns, the same
+// wherever a chunk starts
+static float smooth(uint32_t seed, int32_t x, int32_t period) {
+	int32_t i = floordiv(x, period);
+	float f = (x - i * period) / (float)period;
+	return slerpf((hash2(seed, i) >> 8) / 16777216.0f, (hash2(seed, i + 1) >> 8) / 16777216.0f, f);
+}
+
+// Streams of the seed, one per thing that's made
+#define SEED_ROLL 0x00000000u
+#define SEED_RIPPLE 0x5bd1e995u
+#define SEED_ROCKS 0x27d4eb2fu
+#define SEED_KELP 0x165667b1u
+
+void world_generate(struct Chunk *c, uint32_t seed, int32_t index) {
+	c->index = index;
+	c->valid = true;
+
+	// Rolling dunes, and ripples on them, around the old flat seabed
+	for(int32_t x = 0; x < CHUNK_WIDTH; x++) {
+		int32_t wx = index * CHUNK_WIDTH + x;
+		c->seabed[x] = 470.0f + 60.0f * smooth(seed ^ SEED_ROLL, wx, 512) + 16.0f * smooth(seed ^ SEED_RIPPLE, wx, 64);
+	}
+
+	// Round rocks lying on that. They're kept inside the chunk, so a chunk
+	// never needs its neighbours.
+	uint32_t h = hash2(seed ^ SEED_ROCKS, index);
+	for(uint8_t rocks = h % 3; rocks > 0; rocks--) {
+		h = mix(h);
+		int32_t radius = 6 + h % 24;
+		int32_t center = radius + (h >> 8) % (CHUNK_WIDTH - 2 * radius);
+		float height = radius * (0.5f + ((h >> 16) & 0xFF) / 255.0f * 0.7f);
+		for(int32_t dx = -radius + 1; dx < radius; dx++) {
+			float across = dx / (float)radius;
+			int16_t top = c->seabed[center + dx] - height * sqrtf(1.0f - across * across);
+			if(top < c->seabed[center + dx]) {
+				c->seabed[center + dx] = top;
+			}
+		}
+	}
+
+	h = hash2(seed ^ SEED_KELP, index);
+	c->kelps = h % (CHUNK_KELP + 1);
+	for(uint8_t i = 0; i < c->kelps; i++) {
+		h = mix(h);
+		c->kelp[i] = (struct Kelp){
+			.x = h % CHUNK_WIDTH,
+			.length = 16 + (h >> 8) % 64,
+			.phase = h >> 16,
+		};
+	}
+}
+
+static struct {
+	struct Chunk slots[CHUNK_SLOTS];
+	uint32_t seed;
+	// Bumped by every reset, so a chunk made for the world before isn't
+	// put into the new one
+	uint32_t resets;
+	uint32_t lookups;
+	uint32_t frame;
+
+	// The chunks the prefetch thread is to make, nearest first going
+	// ahead, then behind
+	int32_t center;
+	int32_t first;
+	int32_t last;
+	int8_t ahead;
+
+	// Nothing could be prefetched for the first frame after a reset, that
+	// one makes its chunks itself
+	bool fresh;
+	bool threaded;
+	bool quit;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+} pool = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.wake = PTHREAD_COND_INITIALIZER,
+};
+
+// The frame's chunks, handed out by world_frame() and read by the tiles
+// without taking the lock. The pool doesn't make them over until the next
+// frame.
+static struct {
+	int32_t first;
+	uint8_t count;
+	const struct Chunk *chunk[VIEW_CHUNKS];
+} view;
+
+static struct {
+	uint32_t hits;
+	uint32_t misses;
+	uint32_t in_frame;
+	uint32_t prefetched;
+	uint32_t evictions;
+	uint32_t generated;
+	uint64_t generate_ns;
+} stats;
+
+// With the lock held from here down
+
+static struct Chunk *find(int32_t index) {
+	for(uint8_t i = 0; i < CHUNK_SLOTS; i++) {
+		if(pool.slots[i].valid && pool.slots[i].index == index) {
+			return &pool.slots[i];
+		}
+	}
+	return NULL;
+}
+
+// An empty slot, or else the least recently used one that isn't in this
+// frame or wanted next. NULL if there's none.
+static struct Chunk *victim(void) {
+	struct Chunk *lru = NULL;
+	for(uint8_t i = 0; i < CHUNK_SLOTS; i++) {
+		struct Chunk *c = &pool.slots[i];
+		if(!c->valid) {
+			return c;
+		}
+		bool wanted = c->index >= pool.first && c->index <= pool.last;
+		if(c->pinned != pool.frame && !wanted && (lru == NULL || c->used < lru->used)) {
+			lru = c;
+		}
+	}
+	if(lru != NULL) {
+		stats.evictions++;
+	}
+	return lru;
+}
+
+static struct Chunk *make(int32_t index) {
+	struct Chunk *c = victim();
+	if(c == NULL) {
+		return NULL;
+	}
+	uint64_t start = prof_now();
+	world_generate(c, pool.seed, index);
+	stats.generate_ns += prof_now() - start;
+	stats.generated++;
+	return c;
+}
+
+// The nearest wanted chunk that isn't there yet. Nothing is wanted before
+// the first frame.
+static bool next_wanted(int32_t *index) {
+	if(pool.ahead == 0) {
+		return false;
+	}
+	int32_t ahead = pool.ahead > 0 ? pool.last : pool.first, behind = pool.ahead > 0 ? pool.first : pool.last;
+	for(int32_t i = pool.center;; i += pool.ahead) {
+		if(find(i) == NULL) {
+			*index = i;
+			return true;
+		}
+		if(i == ahead) break;
+	}
+	for(int32_t i = pool.center - pool.ahead;; i -= pool.ahead) {
+		if(find(i) == NULL) {
+			*index = i;
+			return true;
+		}
+		if(i == behind) break;
+	}
+	return false;
+}
+
+// The chunk is made without the lock and copied into the pool after, so a
+// frame never waits for more than that copy
+static void *prefetcher(void *arg) {
+	pthread_mutex_lock(&pool.lock);
+	for(;;) {
+		int32_t index;
+		while(!pool.quit && !next_wanted(&index)) {
+			pthread_cond_wait(&pool.wake, &pool.lock);
+		}
+		if(pool.quit) {
+			break;
+		}
+		uint32_t seed = pool.seed, resets = pool.resets;
+		pthread_mutex_unlock(&pool.lock);
+
+		struct Chunk made;
+		uint64_t start = prof_now();
+		world_generate(&made, seed, index);
+		uint64_t ns = prof_now() - start;
+
+		pthread_mutex_lock(&pool.lock);
+		stats.generate_ns += ns;
+		stats.generated++;
+		struct Chunk *c;
+		if(pool.resets == resets && find(index) == NULL && (c = victim()) != NULL) {
+			*c = made;
+			stats.prefetched++;
+		}
+	}
+	pthread_mutex_unlock(&pool.lock);
+	return NULL;
+}
+
+// Every chunk from the frame's ones to PREFETCH_CHUNKS beyond them, and
+// further ahead the faster the dolphin goes
+static void want(int32_t first, int32_t last, float velx) {
+	int32_t lead = PREFETCH_CHUNKS + fabsf(velx) * PREFETCH_STEPS / CHUNK_WIDTH;
+	if(lead > PREFETCH_MAX) lead = PREFETCH_MAX;
+	pool.ahead = velx < 0.0f ? -1 : 1;
+	pool.center = pool.ahead > 0 ? first : last;
+	pool.first = first - (pool.ahead < 0 ? lead : 1);
+	pool.last = last + (pool.ahead > 0 ? lead : 1);
+}
+
+void world_reset(uint32_t seed) {
+	pthread_mutex_lock(&pool.lock);
+	memset(pool.slots, 0, sizeof(pool.slots));
+	memset(&view, 0, sizeof(view));
+	pool.seed = seed;
+	pool.resets++;
+	pool.ahead = 0;
+	pool.fresh = true;
+	pthread_mutex_unlock(&pool.lock);
+}
+
+void world_start(void) {
+	pthread_mutex_lock(&pool.lock);
+	pool.quit = false;
+	pool.threaded = pthread_create(&pool.thread, NULL, prefetcher, NULL) == 0;
+	pthread_mutex_unlock(&pool.lock);
+}
+
+void world_stop(void) {
+	pthread_mutex_lock(&pool.lock);
+	bool threaded = pool.threaded;
+	pool.quit = true;
+	pool.threaded = false;
+	pthread_cond_signal(&pool.wake);
+	pthread_mutex_unlock(&pool.lock);
+	if(threaded) {
+		pthread_join(pool.thread, NULL);
+	}
+}
+
+void world_frame(int32_t x0, int32_t x1, float velx) {
+	pthread_mutex_lock(&pool.lock);
+	pool.frame++;
+	view.first = world_chunk_index(x0);
+	int32_t last = world_chunk_index(x1 - 1);
+	assert(last - view.first < VIEW_CHUNKS);
+	view.count = last - view.first + 1;
+	want(view.first, last, velx);
+
+	for(uint8_t i = 0; i < view.count; i++) {
+		struct Chunk *c = find(view.first + i);
+		if(c != NULL) {
+			stats.hits++;
+		} else if((!pool.threaded || pool.fresh) && (c = make(view.first + i)) != NULL) {
+			stats.in_frame++;
+		} else {
+			stats.misses++;
+		}
+		if(c != NULL) {
+			c->used = ++pool.lookups;
+			c->pinned = pool.frame;
+		}
+		view.chunk[i] = c;
+	}
+	pool.fresh = false;
+
+	if(pool.threaded) {
+		pthread_cond_signal(&pool.wake);
+	}
+	pthread_mutex_unlock(&pool.lock);
+}
+
+// Back to reading the frame's chunks, no lock
+
+const struct Chunk *world_chunk(int32_t index) {
+	if(index < view.first || index >= view.first + view.count) {
+		return NULL;
+	}
+	return view.chunk[index - view.first];
+}
+
+int16_t world_seabed(int32_t x) {
+	int32_t index = world_chunk_index(x);
+	const struct Chunk *c = world_chunk(index);
+	return c != NULL ? c->seabed[x - index * CHUNK_WIDTH] : SEABED_FLAT;
+}
+
+void world_seabed_row(int16_t *out, int32_t x0, uint16_t width) {
+	for(uint16_t x = 0; x < width;) {
+		int32_t index = world_chunk_index(x0 + x);
+		const struct Chunk *c = world_chunk(index);
+		// A chunk's worth of columns at once
+		uint16_t col = x0 + x - index * CHUNK_WIDTH;
+		uint16_t n = CHUNK_WIDTH - col < width - x ? CHUNK_WIDTH - col : width - x;
+		for(uint16_t i = 0; i < n; i++) {
+			out[x + i] = c != NULL ? c->seabed[col + i] : SEABED_FLAT;
+		}
+		x += n;
+	}
+}
+
+void world_report(void) {
+	uint32_t total = stats.hits + stats.misses + stats.in_frame;
+	if(total == 0) {
+		return;
+	}
+	printf(
+		"World: %u chunk lookups, %.1f%% hits, %u missed, %u made in the frame, %u prefetched (%u evicted), generate avg %.0f ns\n",
+		total, 100.0 * stats.hits / total, stats.misses, stats.in_frame, stats.prefetched, stats.evictions,
+		stats.generated ? stats.generate_ns / (double)stats.generated : 0.0
+	);
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// The strip of sea the dolphin swims along, made up as it goes from a seed:
+// the seabed's depth in every column, rocks on it and kelp growing from it.
+// The world comes in chunks of CHUNK_WIDTH columns, each made from the seed
+// and its index alone, so it's the same whichever order they're made in.
+//
+// Chunks live in a pool of CHUNK_SLOTS, the least recently used one made
+// over once it's full. world_frame() picks the chunks a frame sees out of
+// the pool, and everything else during the frame reads those. With the
+// prefetch thread running a chunk that isn't there yet is never waited for,
+// it reads as the old flat seabed for that frame and the thread is told to
+// hurry. The thread makes chunks ahead of where the dolphin is going, so that
+// shouldn't happen. Without it the frame makes its chunks itself, which is
+// about a microsecond each.
+
+#define CHUNK_WIDTH 256
+// Enough for the chunks of the widest canvas, and as many again ahead of
+// and behind it
+#define CHUNK_SLOTS 32
+#define CHUNK_KELP 8
+
+// Depth of the seabed where there's no chunk to say, the same ly as before
+// there were chunks
+#define SEABED_FLAT 500
+
+struct Kelp {
+	// Column in the chunk, the root is on the seabed there
+	uint8_t x;
+	uint8_t length;
+	// Where in its sway it starts
+	uint8_t phase;
+};
+
+struct Chunk {
+	// Covers world columns index * CHUNK_WIDTH on
+	int32_t index;
+	bool valid;
+	// Lookup it was last handed out for, and the frame that uses it, which
+	// keeps it from being made over under that frame
+	uint32_t used;
+	uint32_t pinned;
+
+	// ly of the seabed in every column, rocks included
+	int16_t seabed[CHUNK_WIDTH];
+	uint8_t kelps;
+	struct Kelp kelp[CHUNK_KELP];
+};
+
+// Make chunk index of the world for seed into c
+void world_generate(struct Chunk *c, uint32_t seed, int32_t index);
+
+// Start over with a new world. The first frame of it makes its chunks
+// itself, there was nothing to prefetch them from.
+void world_reset(uint32_t seed);
+// Make chunks on a thread of their own from now on, instead of in the frame
+// that needs them
+void world_start(void);
+void world_stop(void);
+
+// The chunks under world columns x0 to x1 - 1 for this frame, with the
+// dolphin going velx columns a step. The prefetch thread gets going on the
+// ones ahead.
+void world_frame(int32_t x0, int32_t x1, float velx);
+// The frame's chunk with this index, NULL if it wasn't ready or isn't in
+// the frame
+const struct Chunk *world_chunk(int32_t index);
+// Depth of the seabed under world column x, and under each of width
+// columns from x0
+int16_t world_seabed(int32_t x);
+void world_seabed_row(int16_t *out, int32_t x0, uint16_t width);
+
+static inline int32_t world_chunk_index(int32_t x) {
+	return x >= 0 ? x / CHUNK_WIDTH : -((-x + CHUNK_WIDTH - 1) / CHUNK_WIDTH);
+}
+
+// Hit rate, prefetching and generation time so far
+void world_report(void);